@@ -1,74 +1,290 @@
-/* Eliminate teeny little writes.  patch submitted by 
+/* Eliminate teeny little writes.  patch submitted by
    Rob Ross <rbross@parl.ces.clemson.edu> --Monty 19991008 */
 
+/* Each output stream has a bw_stream of its own, so that several can
+ * be written at once, from as many threads if need be.  A stream can
+ * also hand its full buffers to a thread of its own to write out, so
+ * that a slow disk or pipe doesn't hold up reading; and it can fsync
+ * as it goes or once it's done.
+ */
+
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
-
-#define OUTBUFSZ 32*1024
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "utils.h"
 extern long blocking_write(int outf, char *buffer, long num);
 
+struct bw_stream {
+	int  fd;
+	int  flags;
+	long size;		/* of each buffer */
+	char *buf;		/* the buffer being filled */
+	long pos;
+
+	/* BW_BACKGROUND only */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *spare;		/* the other buffer, if it's free */
+	char *pending;		/* a full buffer for the thread to write */
+	long pendingnum;
+	int  quit;
+	int  err;		/* errno of a failed write on the thread */
+};
+
+/* fsync(), where the descriptor supports it at all */
+static int bw_sync(bw_stream *bw)
+{
+	if (fsync(bw->fd) && errno != EINVAL && errno != EROFS) {
+		perror("fsync (in bw_stream)");
+		return(-1);
+	}
+	return(0);
+}
+
+/* write() out one buffer, as the policy has it */
+static int bw_out(bw_stream *bw, char *buffer, long num)
+{
+	if (blocking_write(bw->fd, buffer, num)) {
+		perror("write (in bw_stream)");
+		return(-1);
+	}
+	if (bw->flags & BW_FSYNC_ALWAYS)
+		return(bw_sync(bw));
+	return(0);
+}
+
+static void *bw_thread(void *arg)
+{
+	bw_stream *bw = arg;
+
+	pthread_mutex_lock(&bw->lock);
+	while (1) {
+		char *buffer;
+		long num;
+		int err = 0;
+
+		while (bw->pending == NULL && !bw->quit)
+			pthread_cond_wait(&bw->cond, &bw->lock);
+		if (bw->pending == NULL)
+			break;
+
+		buffer = bw->pending;
+		num = bw->pendingnum;
+		bw->pending = NULL;
+		pthread_mutex_unlock(&bw->lock);
+
+		if (bw_out(bw, buffer, num))
+			err = errno;
+
+		pthread_mutex_lock(&bw->lock);
+		if (err && !bw->err)
+			bw->err = err;
+		bw->spare = buffer;
+		pthread_cond_broadcast(&bw->cond);
+	}
+	pthread_mutex_unlock(&bw->lock);
+	return(NULL);
+}
+
+/* With BW_BACKGROUND, wait for the thread to be done with the spare
+ * buffer.  Returns -1 (with errno set) if any write it made failed.
+ */
+static int bw_wait(bw_stream *bw)
+{
+	int err;
+
+	pthread_mutex_lock(&bw->lock);
+	while (bw->spare == NULL)
+		pthread_cond_wait(&bw->cond, &bw->lock);
+	err = bw->err;
+	pthread_mutex_unlock(&bw->lock);
+
+	if (err) {
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
+
+/* Write out the buffer being filled, or hand it to the thread to */
+static int bw_empty(bw_stream *bw)
+{
+	if (bw->pos == 0)
+		return(0);
+
+	if (!(bw->flags & BW_BACKGROUND)) {
+		long num = bw->pos;
+		bw->pos = 0;
+		return(bw_out(bw, bw->buf, num));
+	}
 
-/* GLOBALS FOR BUFFERING CALLS */
-static int  bw_fd  = -1;
-static long bw_pos = 0;
-static char bw_outbuf[OUTBUFSZ];
+	if (bw_wait(bw))
+		return(-1);
+	pthread_mutex_lock(&bw->lock);
+	bw->pending = bw->buf;
+	bw->pendingnum = bw->pos;
+	bw->buf = bw->spare;
+	bw->spare = NULL;
+	pthread_cond_broadcast(&bw->cond);
+	pthread_mutex_unlock(&bw->lock);
+	bw->pos = 0;
+	return(0);
+}
 
+/* blocking_writev() - like blocking_write(), for the buffered data
+ * followed by more of it, in one go.
+ */
+static long blocking_writev(bw_stream *bw, char *buffer, long num)
+{
+	struct iovec iov[2];
+	int n = 0;
+
+	if (bw->pos > 0) {
+		iov[n].iov_base = bw->buf;
+		iov[n].iov_len = bw->pos;
+		n++;
+	}
+	iov[n].iov_base = buffer;
+	iov[n].iov_len = num;
+	n++;
 
-/* buffering_write() - buffers data to a specified size before writing.
+	while (n > 0) {
+		ssize_t ret = writev(bw->fd, iov, n);
+		if (ret == -1) {
+			if (errno != EINTR && errno != EAGAIN)
+				return(-1);
+			ret = 0;
+		}
+		while (n > 0 && (size_t)ret >= iov[0].iov_len) {
+			ret -= iov[0].iov_len;
+			iov[0] = iov[1];
+			n--;
+		}
+		if (n > 0) {
+			iov[0].iov_base = (char *)iov[0].iov_base + ret;
+			iov[0].iov_len -= ret;
+		}
+	}
+	return(0);
+}
+
+/* bw_open() - starts buffering writes to fd, in buffers of (size)
+ * bytes (0 for the default).  Returns NULL if it can't.
+ */
+bw_stream *bw_open(int fd, long size, int flags)
+{
+	bw_stream *bw = calloc(1, sizeof(*bw));
+
+	if (bw == NULL)
+		return(NULL);
+	if (size <= 0)
+		size = BW_DEFAULT_SIZE;
+	bw->fd = fd;
+	bw->flags = flags;
+	bw->size = size;
+	bw->buf = malloc(size);
+	if (bw->buf == NULL) {
+		free(bw);
+		return(NULL);
+	}
+
+	if (flags & BW_BACKGROUND) {
+		bw->spare = malloc(size);
+		pthread_mutex_init(&bw->lock, NULL);
+		pthread_cond_init(&bw->cond, NULL);
+		if (bw->spare == NULL ||
+		    pthread_create(&bw->thread, NULL, bw_thread, bw)) {
+			/* do without */
+			pthread_mutex_destroy(&bw->lock);
+			pthread_cond_destroy(&bw->cond);
+			if (bw->spare)
+				free(bw->spare);
+			bw->spare = NULL;
+			bw->flags &= ~BW_BACKGROUND;
+		}
+	}
+	return(bw);
+}
+
+/* bw_write() - buffers data to a specified size before writing.
  *
  * Restrictions:
- * - MUST CALL BUFFERING_CLOSE() WHEN FINISHED!!!
+ * - MUST CALL BW_CLOSE() WHEN FINISHED!!!
  *
  */
-long buffering_write(int fd, char *buffer, long num)
+long bw_write(bw_stream *bw, char *buffer, long num)
 {
-	if (fd != bw_fd) {
-		/* clean up after buffering for some other file */
-		if (bw_fd >= 0 && bw_pos > 0) {
-			if (blocking_write(bw_fd, bw_outbuf, bw_pos)) {
-				perror("write (in buffering_write, flushing)");
-			}
+	if (bw->pos + num > bw->size && num >= bw->size &&
+	    !(bw->flags & BW_BACKGROUND)) {
+		/* too big to be worth buffering; write out what we have
+		   along with it, without copying it */
+		if (blocking_writev(bw, buffer, num)) {
+			perror("write (in bw_write, large write)");
+			return(-1);
 		}
-		bw_fd  = fd;
-		bw_pos = 0;
+		bw->pos = 0;
+		if (bw->flags & BW_FSYNC_ALWAYS)
+			return(bw_sync(bw));
+		return(0);
 	}
 
-	if (bw_pos + num > OUTBUFSZ) {
-		/* fill our buffer first, then write, then modify buffer and num */
-		memcpy(&bw_outbuf[bw_pos], buffer, OUTBUFSZ - bw_pos);
-		if (blocking_write(fd, bw_outbuf, OUTBUFSZ)) {
-			perror("write (in buffering_write, full buffer)");
+	/* (the background thread may only be handed our own buffers; the
+	   caller's could change as soon as we return) */
+	while (num > 0) {
+		long n = bw->size - bw->pos;
+		if (n > num)
+			n = num;
+		memcpy(bw->buf + bw->pos, buffer, n);
+		bw->pos += n;
+		buffer += n;
+		num -= n;
+		if (bw->pos == bw->size && bw_empty(bw))
 			return(-1);
-		}
-		num -= (OUTBUFSZ - bw_pos);
-		buffer += (OUTBUFSZ - bw_pos);
-		bw_pos = 0;
 	}
-	/* save data */
-	if(buffer && num)
-	  memcpy(&bw_outbuf[bw_pos], buffer, num);
-	bw_pos += num;
+	return(0);
+}
 
+/* bw_flush() - writes out everything buffered so far. */
+int bw_flush(bw_stream *bw)
+{
+	if (bw_empty(bw))
+		return(-1);
+	if (bw->flags & BW_BACKGROUND)
+		return(bw_wait(bw));
 	return(0);
 }
 
-/* buffering_close() - writes out remaining buffered data before closing
- * file.
- *
+/* bw_close() - writes out remaining buffered data before closing
+ * file, and frees the stream.  Returns -1 if any of the writing
+ * failed.
  */
-int buffering_close(int fd)
+int bw_close(bw_stream *bw)
 {
-	if (fd == bw_fd && bw_pos > 0) {
-		/* write out remaining data and clean up */
-		if (blocking_write(fd, bw_outbuf, bw_pos)) {
-			perror("write (in buffering_close)");
-		}
-		bw_fd  = -1;
-		bw_pos = 0;
+	int ret = bw_flush(bw);
+
+	if (bw->flags & BW_BACKGROUND) {
+		pthread_mutex_lock(&bw->lock);
+		bw->quit = 1;
+		pthread_cond_broadcast(&bw->cond);
+		pthread_mutex_unlock(&bw->lock);
+		pthread_join(bw->thread, NULL);
+		pthread_mutex_destroy(&bw->lock);
+		pthread_cond_destroy(&bw->cond);
+		free(bw->spare);
 	}
-	return(close(fd));
+
+	if (bw->flags & (BW_FSYNC | BW_FSYNC_ALWAYS))
+		if (bw_sync(bw))
+			ret = -1;
+	if (close(bw->fd))
+		ret = -1;
+	free(bw->buf);
+	free(bw);
+	return(ret);
 }
@@ -0,0 +1,532 @@
+/******************************************************************
+ * CopyPolicy: GNU Public License 2 applies
+ *
+ * Writes FLAC, encoding on a thread of its own as the audio arrives
+ *
+ * Only as much of FLAC as CD audio needs: 16 bit stereo at 44.1kHz
+ * in fixed size blocks, each channel coded with the best of the fixed
+ * predictors (orders 0-4) and partitioned Rice coded residuals, and
+ * the channels themselves as left/right, left/side, right/side or
+ * mid/side, whichever comes out smallest.
+ *
+ ******************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "header.h"
+#include "flac.h"
+
+#define FLAC_BLOCKSIZE 4096 /* samples per channel in a frame */
+#define FLAC_QUEUE     8    /* blocks that can wait to be encoded */
+#define FLAC_MAXORDER  4    /* of the fixed predictors */
+#define FLAC_MAXPORDER 8    /* Rice partitions (as a power of two) */
+#define FLAC_MAXRICE   14   /* (15 is the escape code) */
+
+#define FLAC_CONSTANT  0
+#define FLAC_VERBATIM  1
+#define FLAC_FIXED     2
+
+typedef struct flac_plan{
+  int type;
+  int order;
+  int porder;
+  int rice[1<<FLAC_MAXPORDER];
+  long bits;
+} flac_plan;
+
+struct flac_stream{
+  bw_stream *bw;
+  long frames;
+
+  /* blocks of interleaved samples; flac_write() fills them at head,
+     the encoder takes them from tail */
+  int16_t *queue[FLAC_QUEUE];
+  long fill[FLAC_QUEUE];
+  int head;
+  int tail;
+  int count;
+  int done;
+  int err;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* the encoder's own */
+  int32_t *x[4]; /* left, right, mid and side */
+  int32_t *r[4]; /* and their residuals */
+  flac_plan plan[4];
+  unsigned char *frame;
+};
+
+/**** Bitstream **********************************************************/
+
+typedef struct flac_bits{
+  unsigned char *buf;
+  long pos;
+  uint64_t acc;
+  int bits;
+} flac_bits;
+
+static void put_bits(flac_bits *b,uint32_t v,int n){
+  if(n<32)v&=((uint32_t)1<<n)-1;
+  b->acc=(b->acc<<n)|v;
+  b->bits+=n;
+  while(b->bits>=8){
+    b->bits-=8;
+    b->buf[b->pos++]=b->acc>>b->bits;
+  }
+}
+
+static void put_unary(flac_bits *b,uint32_t q){
+  while(q>=32){
+    put_bits(b,0,32);
+    q-=32;
+  }
+  put_bits(b,1,q+1);
+}
+
+/* frame numbers are coded as in UTF-8 */
+static void put_utf8(flac_bits *b,uint32_t v){
+  int n,i;
+
+  if(v<0x80){
+    put_bits(b,v,8);
+    return;
+  }
+  n=(v<0x800?2:v<0x10000?3:v<0x200000?4:v<0x4000000?5:6);
+  put_bits(b,((0xff00>>n)&0xff)|(v>>(6*(n-1))),8);
+  for(i=n-2;i>=0;i--)
+    put_bits(b,0x80|((v>>(6*i))&0x3f),8);
+}
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+static pthread_once_t crc_once=PTHREAD_ONCE_INIT;
+
+static void crc_init(void){
+  int i,j;
+
+  for(i=0;i<256;i++){
+    unsigned c8=i,c16=i<<8;
+    for(j=0;j<8;j++){
+      c8=(c8&0x80?(c8<<1)^0x07:c8<<1)&0xff;
+      c16=(c16&0x8000?(c16<<1)^0x8005:c16<<1)&0xffff;
+    }
+    crc8_table[i]=c8;
+    crc16_table[i]=c16;
+  }
+}
+
+static unsigned crc8(unsigned char *buf,long n){
+  unsigned crc=0;
+  while(n--)crc=crc8_table[crc^*buf++];
+  return(crc);
+}
+
+static unsigned crc16(unsigned char *buf,long n){
+  unsigned crc=0;
+  while(n--)crc=((crc<<8)^crc16_table[(crc>>8)^*buf++])&0xffff;
+  return(crc);
+}
+
+/**** Subframes **********************************************************/
+
+static inline uint32_t zigzag(int32_t r){
+  return(((uint32_t)r<<1)^(uint32_t)(r>>31));
+}
+
+/* the fixed predictor whose residual is smallest */
+static int fixed_order(int32_t *x,long n){
+  uint64_t sum[FLAC_MAXORDER+1]={0,0,0,0,0};
+  int order,best=0;
+  long i;
+
+  for(i=FLAC_MAXORDER;i<n;i++){
+    int32_t e0=x[i];
+    int32_t e1=e0-x[i-1];
+    int32_t e2=e1-(x[i-1]-x[i-2]);
+    int32_t e3=e2-(x[i-1]-2*x[i-2]+x[i-3]);
+    int32_t e4=e3-(x[i-1]-3*x[i-2]+3*x[i-3]-x[i-4]);
+    sum[0]+=abs(e0);
+    sum[1]+=abs(e1);
+    sum[2]+=abs(e2);
+    sum[3]+=abs(e3);
+    sum[4]+=abs(e4);
+  }
+  for(order=1;order<=FLAC_MAXORDER && order<n;order++)
+    if(sum[order]<sum[best])best=order;
+  return(best);
+}
+
+static void fixed_residual(int32_t *x,long n,int order,int32_t *r){
+  long i;
+
+  switch(order){
+  case 0:
+    for(i=0;i<n;i++)r[i]=x[i];
+    break;
+  case 1:
+    for(i=1;i<n;i++)r[i]=x[i]-x[i-1];
+    break;
+  case 2:
+    for(i=2;i<n;i++)r[i]=x[i]-2*x[i-1]+x[i-2];
+    break;
+  case 3:
+    for(i=3;i<n;i++)r[i]=x[i]-3*x[i-1]+3*x[i-2]-x[i-3];
+    break;
+  case 4:
+    for(i=4;i<n;i++)r[i]=x[i]-4*x[i-1]+6*x[i-2]-4*x[i-3]+x[i-4];
+    break;
+  }
+}
+
+/* Picks the Rice partitioning and parameters for the residual (r) of
+   an order (order) predictor, and returns the bits it'll take.  Costs
+   are reckoned from each partition's sum, which never comes in under
+   what the partition actually takes. */
+static long rice_plan(int32_t *r,long n,int order,flac_plan *plan){
+  uint64_t sum[1<<FLAC_MAXPORDER];
+  int rice[1<<FLAC_MAXPORDER];
+  int maxp=0,po;
+  long best=-1;
+
+  /* the finest partitioning the block allows */
+  while(maxp<FLAC_MAXPORDER && !(n&((2L<<maxp)-1)) && (n>>(maxp+1))>order)
+    maxp++;
+
+  {
+    long parts=1<<maxp,size=n>>maxp,i,j=order;
+    for(i=0;i<parts;i++){
+      uint64_t s=0;
+      for(;j<(i+1)*size;j++)s+=zigzag(r[j]);
+      sum[i]=s;
+    }
+  }
+
+  for(po=maxp;po>=0;po--){
+    long parts=1<<po,size=n>>po,bits=6,i;
+
+    for(i=0;i<parts;i++){
+      long count=size-(i?0:order);
+      uint64_t cost=(uint64_t)-1;
+      int k;
+      for(k=0;k<=FLAC_MAXRICE;k++){
+        uint64_t c=count*(k+1)+(sum[i]>>k);
+        if(c<cost){
+          cost=c;
+          rice[i]=k;
+        }
+      }
+      bits+=4+cost;
+    }
+
+    if(best==-1 || bits<best){
+      best=bits;
+      plan->porder=po;
+      memcpy(plan->rice,rice,parts*sizeof(*rice));
+    }
+
+    /* merge pairs for the next coarser partitioning */
+    for(i=0;i<parts/2;i++)
+      sum[i]=sum[i*2]+sum[i*2+1];
+  }
+  return(best);
+}
+
+static long subframe_plan(int32_t *x,long n,int bps,int32_t *r,
+                          flac_plan *plan){
+  long verbatim=8+n*bps,i;
+
+  for(i=1;i<n && x[i]==x[0];i++);
+  if(i==n){
+    plan->type=FLAC_CONSTANT;
+    plan->bits=8+bps;
+    return(plan->bits);
+  }
+
+  plan->type=FLAC_FIXED;
+  plan->order=fixed_order(x,n);
+  fixed_residual(x,n,plan->order,r);
+  plan->bits=8+plan->order*bps+rice_plan(r,n,plan->order,plan);
+  if(plan->bits>=verbatim){
+    plan->type=FLAC_VERBATIM;
+    plan->bits=verbatim;
+  }
+  return(plan->bits);
+}
+
+static void subframe_write(flac_bits *b,int32_t *x,int32_t *r,long n,int bps,
+                           flac_plan *plan){
+  long i;
+
+  switch(plan->type){
+  case FLAC_CONSTANT:
+    put_bits(b,0x00,8);
+    put_bits(b,x[0],bps);
+    break;
+  case FLAC_VERBATIM:
+    put_bits(b,0x02,8);
+    for(i=0;i<n;i++)put_bits(b,x[i],bps);
+    break;
+  case FLAC_FIXED:
+    put_bits(b,(0x08|plan->order)<<1,8);
+    for(i=0;i<plan->order;i++)put_bits(b,x[i],bps);
+    put_bits(b,0,2); /* Rice, 4 bit parameters */
+    put_bits(b,plan->porder,4);
+    {
+      long parts=1<<plan->porder,size=n>>plan->porder,p,j=plan->order;
+      for(p=0;p<parts;p++){
+        int k=plan->rice[p];
+        put_bits(b,k,4);
+        for(;j<(p+1)*size;j++){
+          uint32_t u=zigzag(r[j]);
+          put_unary(b,u>>k);
+          put_bits(b,u,k);
+        }
+      }
+    }
+    break;
+  }
+}
+
+/**** Frames *************************************************************/
+
+static int frame_encode(flac_stream *f,int16_t *pcm,long n){
+  /* channel assignments, and the channels they code */
+  static const struct{
+    int assign;
+    int ch[2];
+  } stereo[4]={{1,{0,1}},{8,{0,3}},{9,{3,1}},{10,{2,3}}};
+  int32_t *L=f->x[0],*R=f->x[1],*M=f->x[2],*S=f->x[3];
+  flac_bits b={f->frame,0,0,0};
+  long cost[4],i;
+  int c,best=0;
+
+  for(i=0;i<n;i++){
+    L[i]=pcm[i*2];
+    R[i]=pcm[i*2+1];
+    M[i]=(L[i]+R[i])>>1;
+    S[i]=L[i]-R[i];
+  }
+  for(c=0;c<4;c++)
+    cost[c]=subframe_plan(f->x[c],n,c==3?17:16,f->r[c],f->plan+c);
+  for(c=1;c<4;c++)
+    if(cost[stereo[c].ch[0]]+cost[stereo[c].ch[1]]<
+       cost[stereo[best].ch[0]]+cost[stereo[best].ch[1]])
+      best=c;
+
+  put_bits(&b,0xfff8,16); /* sync, fixed blocksize */
+  put_bits(&b,n==FLAC_BLOCKSIZE?12:7,4); /* 4096, or given below */
+  put_bits(&b,9,4); /* 44.1kHz */
+  put_bits(&b,stereo[best].assign,4);
+  put_bits(&b,4<<1,4); /* 16 bits */
+  put_utf8(&b,f->frames);
+  if(n!=FLAC_BLOCKSIZE)put_bits(&b,n-1,16);
+  put_bits(&b,crc8(b.buf,b.pos),8);
+
+  for(i=0;i<2;i++){
+    c=stereo[best].ch[i];
+    subframe_write(&b,f->x[c],f->r[c],n,c==3?17:16,f->plan+c);
+  }
+  if(b.bits)put_bits(&b,0,8-b.bits);
+  put_bits(&b,crc16(b.buf,b.pos),16);
+
+  f->frames++;
+  return(bw_write(f->bw,(char *)b.buf,b.pos));
+}
+
+static void *flac_thread(void *arg){
+  flac_stream *f=arg;
+
+  pthread_mutex_lock(&f->lock);
+  while(1){
+    int16_t *pcm;
+    long n;
+    int err;
+
+    while(!f->count && !f->done)
+      pthread_cond_wait(&f->cond,&f->lock);
+    if(!f->count)break;
+
+    pcm=f->queue[f->tail];
+    n=f->fill[f->tail];
+    err=f->err;
+    pthread_mutex_unlock(&f->lock);
+
+    /* (after a failed write, only keep up with the queue) */
+    if(!err && frame_encode(f,pcm,n))
+      err=errno;
+
+    pthread_mutex_lock(&f->lock);
+    if(err && !f->err)f->err=err;
+    f->fill[f->tail]=0;
+    f->tail=(f->tail+1)%FLAC_QUEUE;
+    f->count--;
+    pthread_cond_broadcast(&f->cond);
+  }
+  pthread_mutex_unlock(&f->lock);
+  return(NULL);
+}
+
+/* hand the block at head to the encoder, and wait for the next one */
+static int flac_queue(flac_stream *f){
+  int err;
+
+  pthread_mutex_lock(&f->lock);
+  f->count++;
+  f->head=(f->head+1)%FLAC_QUEUE;
+  pthread_cond_broadcast(&f->cond);
+  while(f->count==FLAC_QUEUE)
+    pthread_cond_wait(&f->cond,&f->lock);
+  err=f->err;
+  pthread_mutex_unlock(&f->lock);
+
+  if(err){
+    errno=err;
+    return(-1);
+  }
+  return(0);
+}
+
+/**** Streams ************************************************************/
+
+#define FLAC_HEADER 42
+
+/* "fLaC", and STREAMINFO for (bytes) of audio */
+static long flac_header(unsigned char *h,long bytes){
+  flac_bits b={h,0,0,0};
+  uint64_t samples=bytes/4;
+  int i;
+
+  put_bits(&b,0x664c6143,32); /* "fLaC" */
+  put_bits(&b,0x80,8);        /* STREAMINFO, the last metadata block */
+  put_bits(&b,34,24);
+  put_bits(&b,FLAC_BLOCKSIZE,16);
+  put_bits(&b,FLAC_BLOCKSIZE,16);
+  put_bits(&b,0,24);          /* frame sizes unknown */
+  put_bits(&b,0,24);
+  put_bits(&b,44100,20);
+  put_bits(&b,2-1,3);
+  put_bits(&b,16-1,5);
+  put_bits(&b,samples>>32,4);
+  put_bits(&b,samples,32);
+  for(i=0;i<4;i++)            /* no MD5 */
+    put_bits(&b,0,32);
+  return(b.pos);
+}
+
+static void flac_free(flac_stream *f){
+  int i;
+
+  for(i=0;i<FLAC_QUEUE;i++)
+    if(f->queue[i])free(f->queue[i]);
+  for(i=0;i<4;i++){
+    if(f->x[i])free(f->x[i]);
+    if(f->r[i])free(f->r[i]);
+  }
+  if(f->frame)free(f->frame);
+  free(f);
+}
+
+/* flac_open() - writes the FLAC header for (bytes) of audio to (bw),
+ * and starts an encoder for it.  Returns NULL if it can't.
+ */
+flac_stream *flac_open(bw_stream *bw,long bytes){
+  unsigned char header[FLAC_HEADER];
+  flac_stream *f=calloc(1,sizeof(*f));
+  int i;
+
+  if(f==NULL)return(NULL);
+  pthread_once(&crc_once,crc_init);
+
+  f->bw=bw;
+  for(i=0;i<FLAC_QUEUE;i++)
+    if(!(f->queue[i]=malloc(FLAC_BLOCKSIZE*2*sizeof(int16_t))))
+      goto err;
+  for(i=0;i<4;i++)
+    if(!(f->x[i]=malloc(FLAC_BLOCKSIZE*sizeof(int32_t))) ||
+       !(f->r[i]=malloc(FLAC_BLOCKSIZE*sizeof(int32_t))))
+      goto err;
+  /* a frame never takes more than its samples verbatim */
+  if(!(f->frame=malloc(FLAC_BLOCKSIZE*2*sizeof(int32_t)+64)))
+    goto err;
+
+  if(bw_write(bw,(char *)header,flac_header(header,bytes)))
+    goto err;
+
+  pthread_mutex_init(&f->lock,NULL);
+  pthread_cond_init(&f->cond,NULL);
+  if(pthread_create(&f->thread,NULL,flac_thread,f)){
+    pthread_mutex_destroy(&f->lock);
+    pthread_cond_destroy(&f->cond);
+    goto err;
+  }
+  return(f);
+
+ err:
+  flac_free(f);
+  return(NULL);
+}
+
+/* flac_write() - queues (bytes) of interleaved samples, in host byte
+ * order, to be encoded.  Returns -1 if an earlier write of encoded
+ * audio failed.
+ */
+int flac_write(flac_stream *f,char *buffer,long bytes){
+  long samples=bytes/4;
+
+  while(samples>0){
+    long n=FLAC_BLOCKSIZE-f->fill[f->head];
+    if(n>samples)n=samples;
+
+    memcpy(f->queue[f->head]+f->fill[f->head]*2,buffer,n*4);
+    f->fill[f->head]+=n;
+    buffer+=n*4;
+    samples-=n;
+
+    if(f->fill[f->head]==FLAC_BLOCKSIZE && flac_queue(f))
+      return(-1);
+  }
+  return(0);
+}
+
+/* flac_finalize() - rewrites the header at offset (at) of file (fd)
+ * for (bytes) of audio after all; see FinalizeHeader().
+ */
+int flac_finalize(int fd,off_t at,long bytes){
+  unsigned char header[FLAC_HEADER];
+  return(FinalizeHeader(fd,at,header,flac_header(header,bytes)));
+}
+
+/* flac_close() - encodes what's left and frees the stream (but leaves
+ * the bw_stream it wrote to open).  Returns -1 if any writing failed.
+ */
+int flac_close(flac_stream *f){
+  int err;
+
+  if(f->fill[f->head])
+    flac_queue(f);
+
+  pthread_mutex_lock(&f->lock);
+  f->done=1;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&f->lock);
+  pthread_join(f->thread,NULL);
+
+  err=f->err;
+  pthread_mutex_destroy(&f->lock);
+  pthread_cond_destroy(&f->cond);
+  flac_free(f);
+
+  if(err){
+    errno=err;
+    return(-1);
+  }
+  return(0);
+}
@@ -0,0 +1,10 @@
+/******************************************************************
+ * CopyPolicy: GNU Public License 2 applies
+ ******************************************************************/
+
+typedef struct flac_stream flac_stream;
+
+extern flac_stream *flac_open(struct bw_stream *bw,long bytes);
+extern int flac_write(flac_stream *f,char *buffer,long bytes);
+extern int flac_close(flac_stream *f);
+extern int flac_finalize(int fd,off_t at,long bytes);
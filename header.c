@@ -5,104 +5,175 @@
  *
  * Writes wav and aifc headers
  *
+ * Each header is put together in memory and written in one go; once
+ * the audio is all out, it can be written again over itself with the
+ * length that actually was.
+ *
  ******************************************************************/
 
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
 
-static void PutNum(long num,int f,int endianness,int bytes){
+static unsigned char *PutNum(unsigned char *h,long num,int endianness,
+                             int bytes){
   int i;
-  unsigned char c;
 
   if(!endianness)
     i=0;
   else
     i=bytes-1;
   while(bytes--){
-    c=(num>>(i<<3))&0xff;
-    if(write(f,&c,1)==-1){
-      perror("Could not write to output.");
-      exit(1);
-    }
+    *h++=(num>>(i<<3))&0xff;
     if(endianness)
       i--;
     else
       i++;
   }
+  return(h);
 }
 
-void WriteWav(int f,long bytes){
+static unsigned char *PutStr(unsigned char *h,const char *s,int bytes){
+  memcpy(h,s,bytes);
+  return(h+bytes);
+}
+
+static long BuildWav(unsigned char *h,long bytes){
+  unsigned char *p=h;
+
   /* quick and dirty */
 
-  write(f,"RIFF",4);               /*  0-3 */
-  PutNum(bytes+44-8,f,0,4);        /*  4-7 */
-  write(f,"WAVEfmt ",8);           /*  8-15 */
-  PutNum(16,f,0,4);                /* 16-19 */
-  PutNum(1,f,0,2);                 /* 20-21 */
-  PutNum(2,f,0,2);                 /* 22-23 */
-  PutNum(44100,f,0,4);             /* 24-27 */
-  PutNum(44100*2*2,f,0,4);         /* 28-31 */
-  PutNum(4,f,0,2);                 /* 32-33 */
-  PutNum(16,f,0,2);                /* 34-35 */
-  write(f,"data",4);               /* 36-39 */
-  PutNum(bytes,f,0,4);             /* 40-43 */
+  p=PutStr(p,"RIFF",4);            /*  0-3 */
+  p=PutNum(p,bytes+44-8,0,4);      /*  4-7 */
+  p=PutStr(p,"WAVEfmt ",8);        /*  8-15 */
+  p=PutNum(p,16,0,4);              /* 16-19 */
+  p=PutNum(p,1,0,2);               /* 20-21 */
+  p=PutNum(p,2,0,2);               /* 22-23 */
+  p=PutNum(p,44100,0,4);           /* 24-27 */
+  p=PutNum(p,44100*2*2,0,4);       /* 28-31 */
+  p=PutNum(p,4,0,2);               /* 32-33 */
+  p=PutNum(p,16,0,2);              /* 34-35 */
+  p=PutStr(p,"data",4);            /* 36-39 */
+  p=PutNum(p,bytes,0,4);           /* 40-43 */
+  return(p-h);
 }
 
-void WriteAiff(int f,long bytes){
+static long BuildAiff(unsigned char *h,long bytes){
+  unsigned char *p=h;
   long size=bytes+54;
   long frames=bytes/4;
 
   /* Again, quick and dirty */
 
-  write(f,"FORM",4);             /*  4 */
-  PutNum(size-8,f,1,4);          /*  8 */
-  write(f,"AIFF",4);             /* 12 */
-
-  write(f,"COMM",4);             /* 16 */
-  PutNum(18,f,1,4);              /* 20 */
-  PutNum(2,f,1,2);               /* 22 */
-  PutNum(frames,f,1,4);          /* 26 */    
-  PutNum(16,f,1,2);              /* 28 */
-  write(f,"@\016\254D\0\0\0\0\0\0",10); /* 38 (44.100 as a float) */
-
-  write(f,"SSND",4);             /* 42 */
-  PutNum(bytes+8,f,1,4);         /* 46 */
-  PutNum(0,f,1,4);               /* 50 */
-  PutNum(0,f,1,4);               /* 54 */
-
+  p=PutStr(p,"FORM",4);          /*  4 */
+  p=PutNum(p,size-8,1,4);        /*  8 */
+  p=PutStr(p,"AIFF",4);          /* 12 */
+
+  p=PutStr(p,"COMM",4);          /* 16 */
+  p=PutNum(p,18,1,4);            /* 20 */
+  p=PutNum(p,2,1,2);             /* 22 */
+  p=PutNum(p,frames,1,4);        /* 26 */
+  p=PutNum(p,16,1,2);            /* 28 */
+  p=PutStr(p,"@\016\254D\0\0\0\0\0\0",10); /* 38 (44.100 as a float) */
+
+  p=PutStr(p,"SSND",4);          /* 42 */
+  p=PutNum(p,bytes+8,1,4);       /* 46 */
+  p=PutNum(p,0,1,4);             /* 50 */
+  p=PutNum(p,0,1,4);             /* 54 */
+  return(p-h);
 }
 
-void WriteAifc(int f,long bytes){
+static long BuildAifc(unsigned char *h,long bytes){
+  unsigned char *p=h;
   long size=bytes+86;
   long frames=bytes/4;
 
   /* Again, quick and dirty */
 
-  write(f,"FORM",4);             /*  4 */
-  PutNum(size-8,f,1,4);          /*  8 */
-  write(f,"AIFC",4);             /* 12 */
-  write(f,"FVER",4);             /* 16 */
-  PutNum(4,f,1,4);               /* 20 */
-  PutNum(2726318400UL,f,1,4);    /* 24 */
-
-  write(f,"COMM",4);             /* 28 */
-  PutNum(38,f,1,4);              /* 32 */
-  PutNum(2,f,1,2);               /* 34 */
-  PutNum(frames,f,1,4);          /* 38 */    
-  PutNum(16,f,1,2);              /* 40 */
-  write(f,"@\016\254D\0\0\0\0\0\0",10); /* 50 (44.100 as a float) */
-
-  write(f,"NONE",4);             /* 54 */
-  PutNum(14,f,1,1);              /* 55 */
-  write(f,"not compressed",14);  /* 69 */
-  PutNum(0,f,1,1);               /* 70 */
-
-  write(f,"SSND",4);             /* 74 */
-  PutNum(bytes+8,f,1,4);         /* 78 */
-  PutNum(0,f,1,4);               /* 82 */
-  PutNum(0,f,1,4);               /* 86 */
+  p=PutStr(p,"FORM",4);          /*  4 */
+  p=PutNum(p,size-8,1,4);        /*  8 */
+  p=PutStr(p,"AIFC",4);          /* 12 */
+  p=PutStr(p,"FVER",4);          /* 16 */
+  p=PutNum(p,4,1,4);             /* 20 */
+  p=PutNum(p,2726318400UL,1,4);  /* 24 */
+
+  p=PutStr(p,"COMM",4);          /* 28 */
+  p=PutNum(p,38,1,4);            /* 32 */
+  p=PutNum(p,2,1,2);             /* 34 */
+  p=PutNum(p,frames,1,4);        /* 38 */
+  p=PutNum(p,16,1,2);            /* 40 */
+  p=PutStr(p,"@\016\254D\0\0\0\0\0\0",10); /* 50 (44.100 as a float) */
+
+  p=PutStr(p,"NONE",4);          /* 54 */
+  p=PutNum(p,14,1,1);            /* 55 */
+  p=PutStr(p,"not compressed",14); /* 69 */
+  p=PutNum(p,0,1,1);             /* 70 */
+
+  p=PutStr(p,"SSND",4);          /* 74 */
+  p=PutNum(p,bytes+8,1,4);       /* 78 */
+  p=PutNum(p,0,1,4);             /* 82 */
+  p=PutNum(p,0,1,4);             /* 86 */
+  return(p-h);
+}
+
+static void WriteHeader(int f,unsigned char *h,long len){
+  if(write(f,h,len)!=len){
+    perror("Could not write to output.");
+    exit(1);
+  }
+}
+
+/* HeaderOffset() - where in file (f) a header written now would
+ * start, or -1 if it couldn't be written over later: a pipe can't be
+ * seeked, and output opened to append goes to the end whatever the
+ * offset.
+ */
+off_t HeaderOffset(int f){
+  int flags=fcntl(f,F_GETFL);
+  if(flags==-1 || (flags&O_APPEND))return(-1);
+  return(lseek(f,0,SEEK_CUR));
+}
+
+/* FinalizeHeader() - writes (header) over the one at offset (at) of
+ * file (f), as found by HeaderOffset() before it was written.  Output
+ * that can't be rewritten (at<0) keeps whatever length it was given
+ * when it began, which is only wrong if the rip didn't finish; that
+ * isn't an error.
+ */
+int FinalizeHeader(int f,off_t at,unsigned char *header,long len){
+  if(at<0)return(0);
+  if(pwrite(f,header,len,at)!=len)return(-1);
+  return(0);
+}
+
+void WriteWav(int f,long bytes){
+  unsigned char h[44];
+  WriteHeader(f,h,BuildWav(h,bytes));
+}
 
+void WriteAiff(int f,long bytes){
+  unsigned char h[54];
+  WriteHeader(f,h,BuildAiff(h,bytes));
 }
 
+void WriteAifc(int f,long bytes){
+  unsigned char h[86];
+  WriteHeader(f,h,BuildAifc(h,bytes));
+}
+
+int FinalizeWav(int f,off_t at,long bytes){
+  unsigned char h[44];
+  return(FinalizeHeader(f,at,h,BuildWav(h,bytes)));
+}
+
+int FinalizeAiff(int f,off_t at,long bytes){
+  unsigned char h[54];
+  return(FinalizeHeader(f,at,h,BuildAiff(h,bytes)));
+}
+
+int FinalizeAifc(int f,off_t at,long bytes){
+  unsigned char h[86];
+  return(FinalizeHeader(f,at,h,BuildAifc(h,bytes)));
+}
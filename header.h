@@ -4,7 +4,17 @@
  ******************************************************************/
 
 #include <unistd.h>
+#include <sys/types.h>
 
 extern void WriteWav(int f,long bytes);
 extern void WriteAifc(int f,long bytes);
 extern void WriteAiff(int f,long bytes);
+
+/* where the header is about to go; -1 if it can't be rewritten */
+extern off_t HeaderOffset(int f);
+
+/* rewrite the header at (at), for (bytes) of audio after all */
+extern int FinalizeWav(int f,off_t at,long bytes);
+extern int FinalizeAifc(int f,off_t at,long bytes);
+extern int FinalizeAiff(int f,off_t at,long bytes);
+extern int FinalizeHeader(int f,off_t at,unsigned char *header,long len);
@@ -17,6 +17,8 @@
 #define CD_FRAMESIZE_RAW 2352
 #endif
 #define CD_FRAMESAMPLES (CD_FRAMESIZE_RAW / 4)
+#define MAX_SG_SECTORS 255 /* the most sectors one read may ask for: the
+			      read commands' transfer length is a byte */
 
 #include <sys/types.h>
 #include <signal.h>
@@ -133,6 +135,12 @@ extern long cdda_read(cdrom_drive *d, void *buffer,
 		       long beginsector, long sectors);
 extern long cdda_read_timed(cdrom_drive *d, void *buffer,
 			    long beginsector, long sectors, int *milliseconds);
+extern int cdda_read_queue_depth(cdrom_drive *d);
+extern int cdda_read_submit(cdrom_drive *d, void *buffer,
+			    long beginsector, long sectors);
+extern long cdda_read_reap(cdrom_drive *d);
+extern int cdda_read_pollfd(cdrom_drive *d);
+extern int cdda_read_offload(cdrom_drive *d, int enable);
 
 extern long cdda_track_firstsector(cdrom_drive *d,int track);
 extern long cdda_track_lastsector(cdrom_drive *d,int track);
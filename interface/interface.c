@@ -30,6 +30,8 @@ static void _clean_messages(cdrom_drive *d){
 /* doubles as "cdrom_drive_free()" */
 int cdda_close(cdrom_drive *d){
   if(d){
+    if(d->private_data)
+      cdda_read_offload(d,0);
     if(d->opened)
       d->enable_cdda(d,0);
 
@@ -107,25 +109,28 @@ int cdda_speed_set(cdrom_drive *d, int speed)
   return -405;
 }
 
+static void i_read_swap(cdrom_drive *d, void *buffer, long sectors){
+  /* byteswap? */
+  if(d->bigendianp==-1) /* not determined yet */
+    d->bigendianp=data_bigendianp(d);
+
+  if(buffer && d->bigendianp!=bigendianp()){
+    int i;
+    u_int16_t *p=(u_int16_t *)buffer;
+    long els=sectors*CD_FRAMESIZE_RAW/2;
+
+    for(i=0;i<els;i++)p[i]=swap16(p[i]);
+  }
+}
+
 long cdda_read_timed(cdrom_drive *d, void *buffer, long beginsector, long sectors, int *ms){
   if(ms)*ms= -1;
   if(d->opened){
     if(sectors>0){
       sectors=d->read_audio(d,buffer,beginsector,sectors);
 
-      if(sectors>0){
-	/* byteswap? */
-	if(d->bigendianp==-1) /* not determined yet */
-	  d->bigendianp=data_bigendianp(d);
-	
-	if(buffer && d->bigendianp!=bigendianp()){
-	  int i;
-	  u_int16_t *p=(u_int16_t *)buffer;
-	  long els=sectors*CD_FRAMESIZE_RAW/2;
-	  
-	  for(i=0;i<els;i++)p[i]=swap16(p[i]);
-	}
-      }	
+      if(sectors>0)
+	i_read_swap(d,buffer,sectors);
     }
     if(ms)*ms=d->private_data->last_milliseconds;
     return(sectors);
@@ -139,6 +144,189 @@ long cdda_read(cdrom_drive *d, void *buffer, long beginsector, long sectors){
   return cdda_read_timed(d,buffer,beginsector,sectors,NULL);
 }
 
+/* Queued reads: up to cdda_read_queue_depth() reads may be started
+   with cdda_read_submit() before the first of them is waited for;
+   cdda_read_reap() returns what cdda_read() would have for each, in
+   the order they were submitted.  Where the interface can't keep more
+   than one command outstanding, the depth is 1 and submitting simply
+   does the read, unless cdda_read_offload() has given the drive a
+   thread to read on. */
+
+/* how many reads the sg driver itself will queue (1 for none) */
+static int i_sg_depth(cdrom_drive *d){
+  switch(d->interface){
+  case SGIO_SCSI_BUGGY1:  
+  case SGIO_SCSI:  
+    if(d->opened)
+      return(scsi_read_queue_depth(d));
+  }
+  return(1);
+}
+
+int cdda_read_queue_depth(cdrom_drive *d){
+  int depth=i_sg_depth(d);
+  if(depth==1 && d->private_data->offload)
+    depth=MAX_QUEUED_READS;
+  return(depth);
+}
+
+/* returns -1 if the queue is already full */
+int cdda_read_submit(cdrom_drive *d, void *buffer, long beginsector, long sectors){
+  cdda_private_data_t *pd=d->private_data;
+  struct cdda_queued_read *q;
+  int depth=cdda_read_queue_depth(d);
+
+  if(pd->queue_count>=depth)return(-1);
+  q=pd->queue+(pd->queue_head+pd->queue_count)%MAX_QUEUED_READS;
+  pd->queue_count++;
+
+  q->d=d;
+  q->buffer=buffer;
+  q->begin=beginsector;
+  q->sectors=sectors;
+  q->queued=0;
+  if(depth>1 && i_sg_depth(d)==1){
+    /* every read goes to the thread, so that it alone uses the drive */
+    pthread_mutex_lock(&pd->offload_lock);
+    q->queued=QUEUED_THREAD;
+    q->done=0;
+    pd->offload_pending++;
+    pthread_cond_broadcast(&pd->offload_cond);
+    pthread_mutex_unlock(&pd->offload_lock);
+    return(0);
+  }
+
+  if(depth>1 && buffer && sectors>0 && !scsi_read_submit(d,q))
+    q->queued=QUEUED_SG;
+  else
+    q->ret=cdda_read(d,buffer,beginsector,sectors);
+  return(0);
+}
+
+long cdda_read_reap(cdrom_drive *d){
+  cdda_private_data_t *pd=d->private_data;
+  struct cdda_queued_read *q;
+
+  if(pd->queue_count==0)return(-1);
+  q=pd->queue+pd->queue_head;
+  pd->queue_head=(pd->queue_head+1)%MAX_QUEUED_READS;
+  pd->queue_count--;
+
+  if(q->queued==QUEUED_SG){
+    if((q->ret=scsi_read_reap(d,q))>0)
+      i_read_swap(d,q->buffer,q->ret);
+    else
+      q->ret=cdda_read(d,q->buffer,q->begin,q->sectors);
+  }
+  if(q->queued==QUEUED_THREAD){
+    char c;
+    pthread_mutex_lock(&pd->offload_lock);
+    while(!q->done)
+      pthread_cond_wait(&pd->offload_cond,&pd->offload_lock);
+    pthread_mutex_unlock(&pd->offload_lock);
+    while(read(pd->offload_pipe[0],&c,1)<0 && errno==EINTR);
+    errno=q->err;
+  }
+  q->queued=0;
+  return(q->ret);
+}
+
+/* A descriptor that poll()s readable once a submitted read is done, so
+   that one thread can keep reads going on several drives; -1 if reads
+   on this drive are done as they are submitted. */
+int cdda_read_pollfd(cdrom_drive *d){
+  if(i_sg_depth(d)>1)return(d->ioctl_fd);
+  if(d->private_data->offload)return(d->private_data->offload_pipe[0]);
+  return(-1);
+}
+
+/**** Offload ************************************************************/
+
+/* The cooked ioctl, SG_IO on a block device and the old sg interface
+   all read one blocking command at a time.  With offload enabled,
+   reads submitted to such a drive are done, in order, on a thread of
+   its own instead, and submitting returns at once.  While any are
+   outstanding, only the queued read calls may be used on the drive.
+   Reads the sg driver can queue itself are left to it. */
+
+static void *i_offload_thread(void *arg){
+  cdda_private_data_t *pd=arg;
+
+  pthread_mutex_lock(&pd->offload_lock);
+  while(1){
+    struct cdda_queued_read *q;
+    long ret;
+    int err;
+
+    while(pd->offload_pending==0 && !pd->offload_quit)
+      pthread_cond_wait(&pd->offload_cond,&pd->offload_lock);
+    if(pd->offload_pending==0)break;
+
+    q=pd->queue+pd->offload_next;
+    pd->offload_next=(pd->offload_next+1)%MAX_QUEUED_READS;
+    pd->offload_pending--;
+    pthread_mutex_unlock(&pd->offload_lock);
+
+    errno=0;
+    ret=cdda_read(q->d,q->buffer,q->begin,q->sectors);
+    err=errno;
+
+    pthread_mutex_lock(&pd->offload_lock);
+    q->ret=ret;
+    q->err=err;
+    q->done=1;
+    while(write(pd->offload_pipe[1],"",1)<0 && errno==EINTR);
+    pthread_cond_broadcast(&pd->offload_cond);
+  }
+  pthread_mutex_unlock(&pd->offload_lock);
+  return(NULL);
+}
+
+/* enable<0 is a query.  Offload is only enabled with no reads
+   outstanding; disabling it first waits for (and drops) any that are,
+   so that nothing is left using the drive or its private data.
+   Returns whether offload was enabled before the call */
+int cdda_read_offload(cdrom_drive *d, int enable){
+  cdda_private_data_t *pd=d->private_data;
+  int ret=pd->offload;
+
+  if(enable<0)return(ret);
+  if(enable==0)
+    while(pd->queue_count)cdda_read_reap(d);
+  if(pd->queue_count)return(ret);
+
+  if(enable>0 && !pd->offload){
+    if(pipe(pd->offload_pipe))return(ret);
+    pthread_mutex_init(&pd->offload_lock,NULL);
+    pthread_cond_init(&pd->offload_cond,NULL);
+    pd->offload_quit=0;
+    pd->offload_pending=0;
+    pd->offload_next=pd->queue_head;
+    if(pthread_create(&pd->offload_thread,NULL,i_offload_thread,pd)){
+      pthread_mutex_destroy(&pd->offload_lock);
+      pthread_cond_destroy(&pd->offload_cond);
+      close(pd->offload_pipe[0]);
+      close(pd->offload_pipe[1]);
+      return(ret);
+    }
+    pd->offload=1;
+  }
+
+  if(enable==0 && pd->offload){
+    pthread_mutex_lock(&pd->offload_lock);
+    pd->offload_quit=1;
+    pthread_cond_broadcast(&pd->offload_cond);
+    pthread_mutex_unlock(&pd->offload_lock);
+    pthread_join(pd->offload_thread,NULL);
+    pthread_mutex_destroy(&pd->offload_lock);
+    pthread_cond_destroy(&pd->offload_cond);
+    close(pd->offload_pipe[0]);
+    close(pd->offload_pipe[1]);
+    pd->offload=0;
+  }
+  return(ret);
+}
+
 void cdda_verbose_set(cdrom_drive *d,int err_action, int mes_action){
   d->messagedest=mes_action;
   d->errordest=err_action;
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -25,6 +26,7 @@
 #include <sys/shm.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 
 #include <linux/major.h>
 #include <linux/version.h>
@@ -97,11 +99,48 @@ typedef struct sg_io_hdr
 
 #endif
 
+/* a read started by cdda_read_submit() */
+struct cdda_queued_read {
+  cdrom_drive *d;
+  void *buffer;
+  long begin;
+  long sectors;
+  long ret;       /* what it read, once done... */
+  int err;        /* ...and errno, if it was read on the offload thread */
+  int queued;     /* still outstanding: QUEUED_SG or QUEUED_THREAD */
+  int done;       /* set by the offload thread once it has read it */
+
+  unsigned char cmd[12];
+  unsigned int cmd_len;
+  unsigned char sense[SG_MAX_SENSE];
+  struct sg_io_hdr hdr;
+};
+
+#define MAX_QUEUED_READS 4
+#define QUEUED_SG        1 /* at the sg driver */
+#define QUEUED_THREAD    2 /* with the offload thread */
+
 struct cdda_private_data {
   struct sg_header *sg_hd;
   unsigned char *sg_buffer; /* points into sg_hd */
   clockid_t clock;
   int last_milliseconds;
+
+  int queue_depth;  /* 0 until probed */
+  int queue_head;
+  int queue_count;
+  struct cdda_queued_read queue[MAX_QUEUED_READS];
+  struct cdda_queued_read *queue_capture;
+
+  /* see cdda_read_offload() */
+  int offload;
+  int offload_quit;
+  int offload_next;     /* the queue slot the thread takes next */
+  int offload_pending;  /* how many it has yet to take */
+  int offload_pipe[2];  /* a byte per read done, for poll() */
+  pthread_t offload_thread;
+  pthread_mutex_t offload_lock;
+  pthread_cond_t offload_cond;
 };
 
 #define MAX_RETRIES 8
@@ -112,6 +151,9 @@ struct cdda_private_data {
 extern int  cooked_init_drive (cdrom_drive *d);
 extern unsigned char *scsi_inquiry (cdrom_drive *d);
 extern int  scsi_init_drive (cdrom_drive *d);
+extern int  scsi_read_queue_depth (cdrom_drive *d);
+extern int  scsi_read_submit (cdrom_drive *d, struct cdda_queued_read *q);
+extern long scsi_read_reap (cdrom_drive *d, struct cdda_queued_read *q);
 #ifdef CDDA_TEST
 extern int  test_init_drive (cdrom_drive *d);
 #endif
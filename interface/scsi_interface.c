@@ -50,8 +50,7 @@ static void tweak_SG_buffer(cdrom_drive *d) {
   } while(err >= 0 && (cur*(1<<9) < 0x40000000));
   ioctl(d->cdda_fd, SG_GET_RESERVED_SIZE, &reserved);
 
-  /* this doesn't currently ever work, but someday somebody might
-     implement working sg lists with SG_IO devices, so who knows... */
+  /* for SG_IO devices, this is the block queue's max_segments */
   if (ioctl(d->cdda_fd, SG_GET_SG_TABLESIZE, &table) < 0)
     table=1;
 
@@ -61,7 +60,7 @@ static void tweak_SG_buffer(cdrom_drive *d) {
 	  table, reserved, table*(reserved/CD_FRAMESIZE_RAW));
   cdmessage(d,buffer);
 
-  cur=reserved; /* only use one entry for now */
+  cur=reserved; /* max_sectors; less, below, without sg lists */
 
   /* so since we never go above q->max_sectors, we should never get -EIO.
    * we might still get -ENOMEM, but we back off for that later.  Monty
@@ -75,8 +74,26 @@ static void tweak_SG_buffer(cdrom_drive *d) {
    */
   /* Bumping to 64kB  transfer max --Monty */
 
+  /* That limit is for the one buffer the kernel has to find for a
+   * transfer.  SG_IO instead maps the reader's own pages, one
+   * scatter/gather entry each, so where the queue takes more than
+   * one entry we can go up to what it does take (and max_sectors,
+   * above).  If the kernel runs out of memory anyway,
+   * scsi_read_map() drops back to 64kB for good.
+   */
+
   if (!getenv("CDDA_IGNORE_BUFSIZE_LIMIT")) {
-    cur=(cur>1024*64?1024*64:cur);
+    if(table>1 &&
+       (d->interface == SGIO_SCSI || d->interface == SGIO_SCSI_BUGGY1)){
+      /* (an unaligned buffer straddles one page more) */
+      long limit=(table-1)*sysconf(_SC_PAGESIZE);
+
+      if(limit>MAX_SG_SECTORS*CD_FRAMESIZE_RAW)
+	limit=MAX_SG_SECTORS*CD_FRAMESIZE_RAW;
+      if(limit<1024*64)limit=1024*64;
+      cur=(cur>limit?limit:cur);
+    }else
+      cur=(cur>1024*64?1024*64:cur);
   }else{
     cdmessage(d,"\tEnvironment variable CDDA_IGNORE_BUFSIZE_LIMIT set,\n"
 	      "\t\tforcing maximum possible sector size.  This can break\n"
@@ -333,6 +350,9 @@ static int sg2_handle_scsi_cmd(cdrom_drive *d,
   return(0);
 }
 
+/* SG_IO transfers to and from wherever dxferp points, so unlike the
+   sg2 interface there's no need to go through sg_buffer; (buf), if
+   not NULL, is used in its place (and must hold out_size bytes) */
 static int sgio_handle_scsi_cmd(cdrom_drive *d,
 				unsigned char *cmd,
 				unsigned int cmd_len, 
@@ -340,14 +360,17 @@ static int sgio_handle_scsi_cmd(cdrom_drive *d,
 				unsigned int out_size,       
 				unsigned char bytefill,
 				int bytecheck,
-				unsigned char *sense){
+				unsigned char *sense,
+				unsigned char *buf){
 
   int status = 0;
   struct sg_io_hdr hdr;
 
+  if(!buf)buf=d->private_data->sg_buffer;
+
   memset(&hdr,0,sizeof(hdr));
   memset(sense,0,sizeof(sense));
-  memcpy(d->private_data->sg_buffer,cmd+cmd_len,in_size);
+  memcpy(buf,cmd+cmd_len,in_size);
 
   hdr.cmdp = cmd;
   hdr.cmd_len = cmd_len;
@@ -355,12 +378,12 @@ static int sgio_handle_scsi_cmd(cdrom_drive *d,
   hdr.mx_sb_len = SG_MAX_SENSE;
   hdr.timeout = 50000;
   hdr.interface_id = 'S';
-  hdr.dxferp =  d->private_data->sg_buffer;
+  hdr.dxferp = buf;
   hdr.flags = SG_FLAG_DIRECT_IO;  /* direct IO if we can get it */
 
   /* scary buffer fill hack */
   if(bytecheck && out_size>in_size)
-    memset(hdr.dxferp+in_size,bytefill,out_size-in_size); 
+    memset(buf+in_size,bytefill,out_size-in_size); 
 
   if (in_size) {
     hdr.dxfer_len = in_size;
@@ -400,7 +423,7 @@ static int sgio_handle_scsi_cmd(cdrom_drive *d,
   if(bytecheck && in_size<out_size){
     long i,flag=0;
     for(i=in_size;i<out_size;i++)
-      if(d->private_data->sg_buffer[i]!=bytefill){
+      if(buf[i]!=bytefill){
 	flag=1;
 	break;
       }
@@ -428,11 +451,41 @@ static int handle_scsi_cmd(cdrom_drive *d,
 			   unsigned char *sense){
 
   if(d->interface == SGIO_SCSI || d->interface == SGIO_SCSI_BUGGY1)
-    return sgio_handle_scsi_cmd(d,cmd,cmd_len,in_size,out_size,bytefill,bytecheck,sense);
+    return sgio_handle_scsi_cmd(d,cmd,cmd_len,in_size,out_size,bytefill,bytecheck,sense,NULL);
   return sg2_handle_scsi_cmd(d,cmd,cmd_len,in_size,out_size,bytefill,bytecheck,sense);
 
 }
 
+/* The audio reads: with SG_IO the drive transfers straight into the
+   caller's buffer (fill and underrun check included); only the sg2
+   interface, or a read with nowhere to put it, goes through sg_buffer */
+static int handle_scsi_read(cdrom_drive *d,
+			    unsigned char *cmd,
+			    unsigned int cmd_len,
+			    void *p,
+			    long sectors,
+			    unsigned char *sense){
+  struct cdda_queued_read *q=d->private_data->queue_capture;
+  int ret;
+
+  if(q){
+    /* just building the command for scsi_read_submit() */
+    memcpy(q->cmd,cmd,cmd_len);
+    q->cmd_len=cmd_len;
+    q->sectors=sectors;
+    return(0);
+  }
+
+  if(p && (d->interface == SGIO_SCSI || d->interface == SGIO_SCSI_BUGGY1))
+    return sgio_handle_scsi_cmd(d,cmd,cmd_len,0,sectors * CD_FRAMESIZE_RAW,
+				'\177',1,sense,p);
+
+  if((ret=handle_scsi_cmd(d,cmd,cmd_len,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
+    return(ret);
+  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
+  return(0);
+}
+
 static int test_unit_ready(cdrom_drive *d){
   unsigned char sense[SG_MAX_SENSE];
   unsigned char key, ASC, ASCQ;
@@ -800,10 +853,7 @@ static int scsi_set_speed (cdrom_drive *d, int speed){
   return handle_scsi_cmd(d,cmd,12,0,0,0,0,sense);
 }
 
-/* These do one 'extra' copy in the name of clean code */
-
 static int i_read_28 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[10]={0x28, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
   if(d->fua)
@@ -815,14 +865,10 @@ static int i_read_28 (cdrom_drive *d, void *p, long begin, long sectors, unsigne
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,10,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,10,p,sectors,sense));
 }
 
 static int i_read_A8 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
   
   if(d->fua)
@@ -834,14 +880,10 @@ static int i_read_A8 (cdrom_drive *d, void *p, long begin, long sectors, unsigne
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[9] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_D4_10 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[10]={0xd4, 0, 0, 0, 0, 0, 0, 0, 0, 0};
   
   if(d->fua)
@@ -852,14 +894,10 @@ static int i_read_D4_10 (cdrom_drive *d, void *p, long begin, long sectors, unsi
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,10,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,10,p,sectors,sense));
 }
 
 static int i_read_D4_12 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xd4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
   if(d->fua)
@@ -870,14 +908,10 @@ static int i_read_D4_12 (cdrom_drive *d, void *p, long begin, long sectors, unsi
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[9] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_D5 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[10]={0xd5, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
   if(d->fua)
@@ -888,14 +922,10 @@ static int i_read_D5 (cdrom_drive *d, void *p, long begin, long sectors, unsigne
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,10,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,10,p,sectors,sense));
 }
 
 static int i_read_D8 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xd8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
   if(d->fua)
@@ -906,94 +936,67 @@ static int i_read_D8 (cdrom_drive *d, void *p, long begin, long sectors, unsigne
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[9] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmc (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x2, 0, 0, 0, 0, 0, 0, 0, 0x10, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmcB (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x0, 0, 0, 0, 0, 0, 0, 0, 0x10, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmc2 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x2, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmc2B (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x0, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmc3 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x6, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_mmc3B (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xbe, 0x4, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
 
   cmd[3] = (begin >> 16) & 0xFF;
   cmd[4] = (begin >> 8) & 0xFF;
   cmd[5] = begin & 0xFF;
   cmd[8] = sectors;
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 /* straight from the MMC3 spec */
@@ -1018,42 +1021,30 @@ static inline void LBA_to_MSF(long lba,
 
 
 static int i_read_msf (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xb9, 0, 0, 0, 0, 0, 0, 0, 0, 0x10, 0, 0};
 
   LBA_to_MSF(begin,cmd+3,cmd+4,cmd+5);
   LBA_to_MSF(begin+sectors,cmd+6,cmd+7,cmd+8);
 
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_msf2 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xb9, 0, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
 
   LBA_to_MSF(begin,cmd+3,cmd+4,cmd+5);
   LBA_to_MSF(begin+sectors,cmd+6,cmd+7,cmd+8);
 
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 static int i_read_msf3 (cdrom_drive *d, void *p, long begin, long sectors, unsigned char *sense){
-  int ret;
   unsigned char cmd[12]={0xb9, 4, 0, 0, 0, 0, 0, 0, 0, 0xf8, 0, 0};
   
   LBA_to_MSF(begin,cmd+3,cmd+4,cmd+5);
   LBA_to_MSF(begin+sectors,cmd+6,cmd+7,cmd+8);
   
-  if((ret=handle_scsi_cmd(d,cmd,12,0,sectors * CD_FRAMESIZE_RAW,'\177',1,sense)))
-    return(ret);
-  if(p)memcpy(p,d->private_data->sg_buffer,sectors*CD_FRAMESIZE_RAW);
-  return(0);
+  return(handle_scsi_read(d,cmd,12,p,sectors,sense));
 }
 
 
@@ -1068,6 +1059,11 @@ static long scsi_read_map (cdrom_drive *d, void *p, long begin, long sectors,
   sectors=(sectors>d->nsectors?d->nsectors:sectors);
   sectors=(sectors<1?1:sectors);
 
+  if(d->private_data->queue_capture){
+    map(d,p,begin,sectors,sense);
+    return(sectors);
+  }
+
   retry_count=0;
   
   while(1) {
@@ -1118,6 +1114,14 @@ static long scsi_read_map (cdrom_drive *d, void *p, long begin, long sectors,
 	    
 	  cdmessage(d,b);
 	}
+	if(sectors*CD_FRAMESIZE_RAW>MAX_BIG_BUFF_SIZE){
+	  /* past the old ceiling (see tweak_SG_buffer()); stay under
+	     it from now on */
+	  d->nsectors=MAX_BIG_BUFF_SIZE/CD_FRAMESIZE_RAW;
+	  d->bigbuff=d->nsectors*CD_FRAMESIZE_RAW;
+	  sectors=d->nsectors;
+	  continue;
+	}
 	sectors--;
 	continue;
       case ENOMEDIUM:
@@ -1267,24 +1271,132 @@ long scsi_read_msf3 (cdrom_drive *d, void *p, long begin,
   return(scsi_read_map(d,p,begin,sectors,i_read_msf3));
 }
 
+/* Queued reads.  A blocking SG_IO leaves the drive idle for a full
+   round trip between one read and the next; written to an sg device
+   instead, several read commands can be outstanding at once, and are
+   read back in the order they went out (by pack_id).  This needs the
+   sg driver itself, not the block device's SG_IO; anything else reads
+   one at a time as always. */
+
+int scsi_read_queue_depth(cdrom_drive *d){
+  cdda_private_data_t *pd=d->private_data;
+
+  if(!pd->queue_depth){
+    struct stat st;
+    int version=0,one=1;
+
+    pd->queue_depth=1;
+    if(d->interface != SGIO_SCSI && d->interface != SGIO_SCSI_BUGGY1)
+      return(1);
+    if(fstat(d->ioctl_fd,&st) || !S_ISCHR(st.st_mode) ||
+       major(st.st_rdev)!=SCSI_GENERIC_MAJOR)
+      return(1);
+    if(ioctl(d->ioctl_fd,SG_GET_VERSION_NUM,&version) || version<30000)
+      return(1);
+    if(ioctl(d->ioctl_fd,SG_SET_FORCE_PACK_ID,&one))
+      return(1);
+
+    pd->queue_depth=MAX_QUEUED_READS;
+  }
+  return(pd->queue_depth);
+}
+
+/* Start the read (q) describes.  The command is whatever
+   d->read_audio would issue, built by running it with queue_capture
+   set.  Returns nonzero if the read couldn't be queued, and should be
+   done the usual way. */
+int scsi_read_submit(cdrom_drive *d, struct cdda_queued_read *q){
+  cdda_private_data_t *pd=d->private_data;
+  struct sg_io_hdr *hdr=&q->hdr;
+
+  q->queued=0;
+  q->cmd_len=0;
+  pd->queue_capture=q;
+  d->read_audio(d,q->buffer,q->begin,q->sectors);
+  pd->queue_capture=NULL;
+  if(!q->cmd_len)return(-1);
+
+  memset(hdr,0,sizeof(*hdr));
+  memset(q->sense,0,sizeof(q->sense));
+  hdr->interface_id = 'S';
+  hdr->cmdp = q->cmd;
+  hdr->cmd_len = q->cmd_len;
+  hdr->sbp = q->sense;
+  hdr->mx_sb_len = SG_MAX_SENSE;
+  hdr->timeout = 50000;
+  hdr->dxferp = q->buffer;
+  hdr->dxfer_len = q->sectors * CD_FRAMESIZE_RAW;
+  hdr->flags = SG_FLAG_DIRECT_IO;
+  hdr->pack_id = q-pd->queue;
+  hdr->usr_ptr = q;
+  if(d->interface != SGIO_SCSI_BUGGY1)
+    hdr->dxfer_direction = SG_DXFER_TO_FROM_DEV;
+  else
+    hdr->dxfer_direction = SG_DXFER_FROM_DEV;
+
+  /* same fill as sgio_handle_scsi_cmd() */
+  memset(q->buffer,'\177',hdr->dxfer_len);
+
+  if(write(d->ioctl_fd,hdr,sizeof(*hdr))!=sizeof(*hdr))
+    return(-1);
+  q->queued=1;
+  return(0);
+}
+
+/* Wait for a queued read to finish.  Returns the number of sectors
+   read; anything short of a clean, complete read returns -1, and the
+   caller redoes it the usual way, retries and error handling
+   included. */
+long scsi_read_reap(cdrom_drive *d, struct cdda_queued_read *q){
+  struct sg_io_hdr *hdr=&q->hdr;
+  unsigned char *b=q->buffer;
+  long i,bytes=q->sectors*CD_FRAMESIZE_RAW;
+  int flags=fcntl(d->ioctl_fd,F_GETFL);
+  ssize_t status;
+
+  /* the device is open O_NONBLOCK; wait for this one in particular */
+  if(flags!=-1 && (flags&O_NONBLOCK))
+    fcntl(d->ioctl_fd,F_SETFL,flags&~O_NONBLOCK);
+  do
+    status=read(d->ioctl_fd,hdr,sizeof(*hdr));
+  while(status<0 && errno==EINTR);
+  if(flags!=-1 && (flags&O_NONBLOCK))
+    fcntl(d->ioctl_fd,F_SETFL,flags);
+  q->queued=0;
+
+  if(status!=sizeof(*hdr))return(-1);
+  if(hdr->status && check_sbp_error(hdr->status,hdr->sbp))return(-1);
+  if(hdr->host_status || (hdr->driver_status&~0x08 /* DRIVER_SENSE */))
+    return(-1);
+
+  /* the same underrun check as scsi_read_map(): any whole sector left
+     untouched by the drive means a short transfer */
+  for(i=bytes;i>1;i-=2)
+    if(b[i-1]!='\177' || b[i-2]!='\177')
+      break;
+  if(i/CD_FRAMESIZE_RAW!=q->sectors)return(-1);
+
+  return(q->sectors);
+}
+
 
 /* Some drives, given an audio read command, return only 2048 bytes
    of data as opposed to 2352 bytes.  Look for bytess at the end of the
    single sector verification read */
 
-static int count_2352_bytes(cdrom_drive *d){
+static int count_2352_bytes(unsigned char *b){
   long i;
   for(i=2351;i>=0;i--)
-    if(d->private_data->sg_buffer[i]!=(unsigned char)'\177')
+    if(b[i]!=(unsigned char)'\177')
       return(((i+3)>>2)<<2);
 
   return(0);
 }
 
-static int verify_nonzero(cdrom_drive *d){
+static int verify_nonzero(unsigned char *b){
   long i,flag=0;
   for(i=0;i<2352;i++)
-    if(d->private_data->sg_buffer[i]!=0){
+    if(b[i]!=0){
       flag=1;
       break;
     }
@@ -1322,7 +1434,7 @@ static int verify_read_command(cdrom_drive *d){
 	audioflag=1;
 
 	if(d->read_audio(d,buff,sector,1)>0){
-	  if(count_2352_bytes(d)==2352){
+	  if(count_2352_bytes((unsigned char *)buff)==2352){
 	    cdmessage(d,"\tExpected command set reads OK.\n");
 	    d->enable_cdda(d,0);
 	    free(buff);
@@ -1483,8 +1595,8 @@ static int verify_read_command(cdrom_drive *d){
 		long sector=(firstsector+lastsector)>>1;
 		
 		if(d->read_audio(d,buff,sector,1)>0){
-		  if((lengthflag=count_2352_bytes(d))==2352){
-		    if(verify_nonzero(d)){
+		  if((lengthflag=count_2352_bytes((unsigned char *)buff))==2352){
+		    if(verify_nonzero((unsigned char *)buff)){
 		      cdmessage(d,"\t\tCommand set FOUND!\n");
 		      
 		      free(buff);
@@ -37,6 +37,7 @@
 #include "report.h"
 #include "version.h"
 #include "header.h"
+#include "flac.h"
 
 #include <json-c/json.h>
 #include <sys/types.h>
@@ -295,10 +296,32 @@ static void usage(FILE *f){
       "  -R --output-raw-big-endian      : output raw 16-bit big endian PCM\n"
       "  -w --output-wav                 : output as WAV file (default)\n"
       "  -f --output-aiff                : output as AIFF file\n"
-      "  -a --output-aifc                : output as AIFF-C file\n\n"
+      "  -a --output-aifc                : output as AIFF-C file\n"
+      "  --output-flac                   : output as FLAC file, encoded as it\n"
+      "                                    is read\n\n"
 
       "  -c --force-cdrom-little-endian  : force treating drive as little endian\n"
       "  -C --force-cdrom-big-endian     : force treating drive as big endian\n"
+      "  -E --read-ahead                 : read the next block from the drive in\n"
+      "                                    the background while writing out the\n"
+      "                                    last one\n"
+      "  -j --threads <n>                : compare each read against the cached\n"
+      "                                    reads on n threads at once\n"
+      "  --adaptive-reads                : adjust the number of sectors in each\n"
+      "                                    read to the drive as the rip goes\n"
+      "  --offload-reads                 : issue reads from a thread of their own\n"
+      "                                    where the drive interface can't queue\n"
+      "                                    them itself\n"
+      "  --output-buffer <n>             : buffer n kilobytes of output between\n"
+      "                                    writes (default 32)\n"
+      "  --background-write              : write output out on a thread of its\n"
+      "                                    own while reading continues\n"
+      "  --fsync[=always]                : fsync output when done with it (or\n"
+      "                                    after every write)\n"
+      "  --tee <format>[:<file>]         : also write the same audio to file as\n"
+      "                                    raw, raw-little, raw-big, wav, aifc,\n"
+      "                                    aiff or flac ('-' for stdout); may be\n"
+      "                                    repeated\n"
       "  -n --force-default-sectors <n>  : force default number of sectors in read\n"
       "                                    to n sectors\n"
       "  -o --force-search-overlap  <n>  : force minimum overlap search during\n"
@@ -429,6 +452,10 @@ static int psock;
 static struct sockaddr_un name;
 static int skipped_flag=0;
 static int abort_on_skip=0;
+static int read_ahead=0;
+static int threads=1;
+static int adaptive_reads=0;
+static int offload_reads=0;
 FILE *logfile = NULL;
 
 static void init_usock() {
@@ -725,13 +752,17 @@ static void callback(long inpos, int function){
     memset(dispcache,' ',graph);
 }
 
-const char *optstring = "escCn:o:O:d:g:k:S:prRwafvqVQJu:hZz::YXWBi:Tt:l::L::A";
+const char *optstring = "escCEj:n:o:O:d:g:k:S:prRwafvqVQJu:hZz::YXWBi:Tt:l::L::A";
 
 struct option options [] = {
   {"stderr-progress",no_argument,NULL,'e'},
   {"search-for-drive",no_argument,NULL,'s'},
   {"force-cdrom-little-endian",no_argument,NULL,'c'},
   {"force-cdrom-big-endian",no_argument,NULL,'C'},
+  {"read-ahead",no_argument,NULL,'E'},
+  {"threads",required_argument,NULL,'j'},
+  {"adaptive-reads",no_argument,NULL,'N'},
+  {"offload-reads",no_argument,NULL,'U'},
   {"force-default-sectors",required_argument,NULL,'n'},
   {"force-search-overlap",required_argument,NULL,'o'},
   {"force-cdrom-device",required_argument,NULL,'d'},
@@ -747,6 +778,7 @@ struct option options [] = {
   {"output-wav",no_argument,NULL,'w'},
   {"output-aiff",no_argument,NULL,'f'},
   {"output-aifc",no_argument,NULL,'a'},
+  {"output-flac",no_argument,NULL,'K'},
   {"batch",no_argument,NULL,'B'},
   {"verbose",no_argument,NULL,'v'},
   {"quiet",no_argument,NULL,'q'},
@@ -764,6 +796,10 @@ struct option options [] = {
   {"never-skip",optional_argument,NULL,'z'},
   {"log-summary",optional_argument,NULL,'l'},
   {"log-debug",optional_argument,NULL,'L'},
+  {"output-buffer",required_argument,NULL,'b'},
+  {"background-write",no_argument,NULL,'x'},
+  {"fsync",optional_argument,NULL,'y'},
+  {"tee",required_argument,NULL,'I'},
 
   {NULL,0,NULL,0}
 };
@@ -783,10 +819,249 @@ long blocking_write(int outf, char *buffer, long num){
   return(0);
 }
 
+/* The verified sectors as they should be written out.  If they're in
+   the wrong byte order, that's a swapped copy in a scratch buffer kept
+   for the purpose; the library's buffer is left alone. */
+static char *output_swap(int16_t *buffer,long sectors,int endian){
+  static int16_t *scratch=NULL;
+  static long scratchsize=0;
+  long words=sectors*CD_FRAMEWORDS,i;
+
+  if(endian==bigendianp())return((char *)buffer);
+
+  if(words>scratchsize){
+    scratchsize=words;
+    scratch=realloc(scratch,scratchsize*sizeof(*scratch));
+  }
+  for(i=0;i<words;i++)
+    scratch[i]=swap16(buffer[i]);
+  return((char *)scratch);
+}
+
 static cdrom_drive *d=NULL;
 static cdrom_paranoia *p=NULL;
 
+/* Every output is written from the same verified sectors: the one
+   named on the command line (or the default), then any given with
+   --tee, each in its own format and byte order. */
+#define MAX_OUTPUTS 8
+
+typedef struct output_sink{
+  int type;       /* 0=raw, 1=wav, 2=aifc, 3=aiff, 4=flac */
+  int endian;     /* 0=little, 1=big */
+  char *name;     /* as given; NULL for the default, "-" for stdout */
+  char file[256]; /* as opened for this batch; empty for stdout */
+  int fd;
+  off_t header;   /* where in fd the header went; see HeaderOffset() */
+  long bytes;     /* of audio the header was written for... */
+  long written;   /* ...and written since */
+  bw_stream *bw;
+  flac_stream *flac; /* type 4 only; writes to bw */
+} output_sink;
+
+static output_sink outputs[MAX_OUTPUTS];
+static int output_count=1; /* outputs[0] is set up once the options are in */
+
+static const char *output_default[]={"cdda.raw","cdda.wav","cdda.aifc",
+                                     "cdda.aiff","cdda.flac"};
+
+/* --tee format[:file] */
+static int output_tee(char *arg){
+  static const struct{
+    char *format;
+    int type;
+    int endian; /* -1=host */
+  } formats[]={
+    {"raw",0,-1},{"raw-little",0,0},{"raw-big",0,1},
+    {"wav",1,0},{"aifc",2,1},{"aiff",3,1},{"flac",4,-1},{NULL,0,0}};
+  char *colon=strchr(arg,':');
+  size_t len=(colon?(size_t)(colon-arg):strlen(arg));
+  output_sink *s=outputs+output_count;
+  int i;
+
+  if(output_count>=MAX_OUTPUTS)return(-1);
+  for(i=0;formats[i].format;i++)
+    if(strlen(formats[i].format)==len && !strncmp(arg,formats[i].format,len)){
+      s->type=formats[i].type;
+      s->endian=(formats[i].endian==-1?bigendianp():formats[i].endian);
+      s->name=copystring(colon?colon+1:"");
+      output_count++;
+      return(0);
+    }
+  return(-1);
+}
+
+/* open an output for this batch and write its header */
+static void output_open(output_sink *s,int batch,int batch_track,long bytes,
+                        long bufsize,int flags){
+  int out,i;
+
+  if(s->name && !strcmp(s->name,"-")){
+    out=dup(fileno(stdout));
+    if(batch)report("Are you sure you wanted 'batch' "
+        "(-B) output with stdout?");
+    report("outputting to stdout\n");
+    if(logfile){
+      fprintf(logfile,"outputting to stdout\n");
+      fflush(logfile);
+    }
+    s->file[0]='\0';
+  }else{
+    /* the default is the same as an empty filename */
+    char *name=(s->name?s->name:"");
+    char path[256];
+
+    char *post=strrchr(name,'/');
+    int pos=(post?post-name+1:0);
+    char *file=name+pos;
+
+    path[0]='\0';
+
+    if(pos)
+      strncat(path,name,pos>256?256:pos);
+
+    if(batch)
+      snprintf(s->file,246,"%strack%02d.%s",path,batch_track,file);
+    else
+      snprintf(s->file,246,"%s%s",path,file);
+
+    if(file[0]=='\0')
+      strcat(s->file,output_default[s->type]);
+
+    for(i=0;outputs+i<s;i++)
+      if(!strcmp(outputs[i].file,s->file)){
+        report("Output file %s named more than once",s->file);
+        exit(1);
+      }
+
+    out=open(s->file,O_RDWR|O_CREAT|O_TRUNC,0666);
+    if(out==-1){
+      report("Cannot open %s output file %s: %s",
+          s->name?"specified":"default",s->file,strerror(errno));
+      cdda_close(d);
+      d=NULL;
+      exit(1);
+    }
+    report("outputting to %s\n",s->file);
+    if(logfile){
+      fprintf(logfile,"outputting to %s\n",s->file);
+      fflush(logfile);
+    }
+  }
+
+  s->header=HeaderOffset(out);
+  switch(s->type){
+    case 0: /* raw */
+      break;
+    case 1: /* wav */
+      WriteWav(out,bytes);
+      break;
+    case 2: /* aifc */
+      WriteAifc(out,bytes);
+      break;
+    case 3: /* aiff */
+      WriteAiff(out,bytes);
+      break;
+  }
+
+  s->fd=out;
+  s->bytes=bytes;
+  s->written=0;
+  s->bw=bw_open(out,bufsize,flags);
+  if(s->bw==NULL){
+    report("Cannot buffer output: %s",strerror(errno));
+    exit(1);
+  }
+
+  s->flac=NULL;
+  if(s->type==4){
+    /* (the header goes through the encoder) */
+    s->flac=flac_open(s->bw,bytes);
+    if(s->flac==NULL){
+      report("Cannot start FLAC encoder: %s",strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+/* Write (bytes) from (offset) into (sectors) of samples in host order
+   to every output.  Each byte order is swapped for at most once. */
+static void output_write(int16_t *buffer,long sectors,long offset,long bytes){
+  char *swapped=NULL;
+  int i;
+
+  for(i=0;i<output_count;i++){
+    output_sink *s=outputs+i;
+    char *data=(char *)buffer;
+
+    if(s->endian!=bigendianp()){
+      if(!swapped)swapped=output_swap(buffer,sectors,s->endian);
+      data=swapped;
+    }
+    if(s->flac?flac_write(s->flac,data+offset,bytes):
+       bw_write(s->bw,data+offset,bytes)){
+      report("Error writing output: %s",strerror(errno));
+      exit(1);
+    }
+    s->written+=bytes;
+  }
+}
+
+/* Finishes writing an output and closes it.  If less audio went out
+   than its header was written for, the header is put right first. */
+static int output_finish(output_sink *s,int aborted){
+  int err=0;
+
+  if(s->flac && flac_close(s->flac))err=-1;
+  s->flac=NULL;
+
+  if(!aborted && s->written!=s->bytes){
+    if(bw_flush(s->bw))err=-1;
+    switch(s->type){
+      case 1: /* wav */
+        if(FinalizeWav(s->fd,s->header,s->written))err=-1;
+        break;
+      case 2: /* aifc */
+        if(FinalizeAifc(s->fd,s->header,s->written))err=-1;
+        break;
+      case 3: /* aiff */
+        if(FinalizeAiff(s->fd,s->header,s->written))err=-1;
+        break;
+      case 4: /* flac */
+        if(flac_finalize(s->fd,s->header,s->written))err=-1;
+        break;
+    }
+  }
+
+  if(bw_close(s->bw))err=-1;
+  s->bw=NULL;
+  return(err);
+}
+
+/* close every output, and remove them if the batch was aborted */
+static void output_close(int aborted){
+  int i;
+
+  for(i=0;i<output_count;i++)
+    if(output_finish(outputs+i,aborted)){
+      report("Error writing output: %s",strerror(errno));
+      exit(1);
+    }
+  if(aborted)
+    for(i=0;i<output_count;i++)
+      if(outputs[i].file[0]){
+        report("\nRemoving aborted file: %s",outputs[i].file);
+        unlink(outputs[i].file);
+      }
+}
+
 static void cleanup(void){
+  int i;
+
+  /* bailing out mid-rip still leaves what was written readable */
+  for(i=0;i<output_count;i++)
+    if(outputs[i].bw)output_finish(outputs+i,0);
+
   if(p)paranoia_free(p);
   if(d)cdda_close(d);
 
@@ -822,7 +1097,8 @@ int main(int argc,char *argv[]){
   int paranoia_mode=PARANOIA_MODE_FULL^PARANOIA_MODE_NEVERSKIP; 
 
   char *info_file=NULL;
-  int out;
+  long output_buffer=0; /* bytes; 0 for the default */
+  int output_flags=0;
 
   int search=0;
   int c,long_option_index;
@@ -848,6 +1124,18 @@ int main(int argc,char *argv[]){
       case 'C':
         force_cdrom_endian=1;
         break;
+      case 'E':
+        read_ahead=1;
+        break;
+      case 'j':
+        threads=atoi(optarg);
+        break;
+      case 'N':
+        adaptive_reads=1;
+        break;
+      case 'U':
+        offload_reads=1;
+        break;
       case 'n':
         force_cdrom_sectors=atoi(optarg);
         break;
@@ -902,6 +1190,10 @@ int main(int argc,char *argv[]){
         output_type=3;
         output_endian=1;
         break;
+      case 'K':
+        output_type=4;
+        output_endian=bigendianp(); /* the encoder takes host order */
+        break;
       case 'v':
         verbose=CDDA_MESSAGE_PRINTIT;
         quiet=0;
@@ -963,6 +1255,26 @@ int main(int argc,char *argv[]){
       case 'F':
         paranoia_mode&=~(PARANOIA_MODE_FRAGMENT);
         break;
+      case 'b':
+        output_buffer=atol(optarg)*1024;
+        break;
+      case 'x':
+        output_flags|=BW_BACKGROUND;
+        break;
+      case 'y':
+        if(optarg && !strcmp(optarg,"always"))
+          output_flags|=BW_FSYNC_ALWAYS;
+        else
+          output_flags|=BW_FSYNC;
+        break;
+      case 'I':
+        if(output_tee(optarg)){
+          report("--tee wants one of raw, raw-little, raw-big, wav, aifc, "
+              "aiff or flac,\noptionally followed by :file (at most %d outputs)\n",
+              MAX_OUTPUTS-1);
+          exit(1);
+        }
+        break;
       case 'i':
         if(info_file)free(info_file);
         info_file=copystring(info_file);
@@ -1138,8 +1450,8 @@ int main(int argc,char *argv[]){
     }
   }
   if(force_cdrom_sectors!=-1){
-    if(force_cdrom_sectors<0 || force_cdrom_sectors>100){
-      report("Default sector read size must be 1<= n <= 100\n");
+    if(force_cdrom_sectors<0 || force_cdrom_sectors>MAX_SG_SECTORS){
+      report("Default sector read size must be 1<= n <= %d\n",MAX_SG_SECTORS);
       cdda_close(d);
       d=NULL;
       exit(1);
@@ -1326,6 +1638,14 @@ int main(int argc,char *argv[]){
 
       p=paranoia_init(d);
       paranoia_modeset(p,paranoia_mode);
+      if(read_ahead)paranoia_readahead(p,1);
+      if(threads>1)paranoia_threads(p,threads);
+      if(adaptive_reads)paranoia_adaptive_reads(p,1);
+      if(offload_reads){
+        cdda_read_offload(d,1);
+        if(!cdda_read_offload(d,-1))
+          report("Unable to start a thread to read on; reading inline.");
+      }
       if(force_cdrom_overlap!=-1)paranoia_overlapset(p,force_cdrom_overlap);
 
       if(verbose)
@@ -1347,8 +1667,11 @@ int main(int argc,char *argv[]){
       if(sample_offset)
         d->disc_toc[d->tracks].dwStartSector++;
 
+      outputs[0].type=output_type;
+      outputs[0].endian=output_endian;
+      outputs[0].name=(optind+1<argc?argv[optind+1]:NULL);
+
       while(cursor<=last_sector){
-        char outfile_name[256];
         if(batch){
           batch_first=cursor;
           batch_last=
@@ -1366,133 +1689,26 @@ int main(int argc,char *argv[]){
 
         /* argv[optind] is the span, argv[optind+1] (if exists) is outfile */
 
-        if(optind+1<argc){
-          if(!strcmp(argv[optind+1],"-")){
-            out=dup(fileno(stdout));
-            if(batch)report("Are you sure you wanted 'batch' "
-                "(-B) output with stdout?");
-            report("outputting to stdout\n");
-            if(logfile){
-              fprintf(logfile,"outputting to stdout\n");
-              fflush(logfile);
-            }
-            outfile_name[0]='\0';
-          }else{
-            char path[256];
-
-            char *post=strrchr(argv[optind+1],'/');
-            int pos=(post?post-argv[optind+1]+1:0);
-            char *file=argv[optind+1]+pos;
-
-            path[0]='\0';
-
-            if(pos)
-              strncat(path,argv[optind+1],pos>256?256:pos);
-
-            if(batch)
-              snprintf(outfile_name,246,"%strack%02d.%s",path,batch_track,file);
-            else
-              snprintf(outfile_name,246,"%s%s",path,file);
-
-            if(file[0]=='\0'){
-              switch(output_type){
-                case 0: /* raw */
-                  strcat(outfile_name,"cdda.raw");
-                  break;
-                case 1:
-                  strcat(outfile_name,"cdda.wav");
-                  break;
-                case 2:
-                  strcat(outfile_name,"cdda.aifc");
-                  break;
-                case 3:
-                  strcat(outfile_name,"cdda.aiff");
-                  break;
-              }
-            }
-
-            out=open(outfile_name,O_RDWR|O_CREAT|O_TRUNC,0666);
-            if(out==-1){
-              report("Cannot open specified output file %s: %s",outfile_name,
-                  strerror(errno));
-              cdda_close(d);
-              d=NULL;
-              exit(1);
-            }
-            report("outputting to %s\n",outfile_name);
-            if(logfile){
-              fprintf(logfile,"outputting to %s\n",outfile_name);
-              fflush(logfile);
-            }
-          }
-        }else{
-          /* default */
-          if(batch)
-            sprintf(outfile_name,"track%02d.",batch_track);
-          else
-            outfile_name[0]='\0';
-
-          switch(output_type){
-            case 0: /* raw */
-              strcat(outfile_name,"cdda.raw");
-              break;
-            case 1:
-              strcat(outfile_name,"cdda.wav");
-              break;
-            case 2:
-              strcat(outfile_name,"cdda.aifc");
-              break;
-            case 3:
-              strcat(outfile_name,"cdda.aiff");
-              break;
-          }
-
-          out=open(outfile_name,O_RDWR|O_CREAT|O_TRUNC,0666);
-          if(out==-1){
-            report("Cannot open default output file %s: %s",outfile_name,
-                strerror(errno));
-            cdda_close(d);
-            d=NULL;
-            exit(1);
-          }
-          report("outputting to %s\n",outfile_name);
-          if(logfile){
-            fprintf(logfile,"outputting to %s\n",outfile_name);
-            fflush(logfile);
-          }
-        }
-
-        switch(output_type){
-          case 0: /* raw */
-            break;
-          case 1: /* wav */
-            WriteWav(out,(batch_last-batch_first+1)*CD_FRAMESIZE_RAW);
-            break;
-          case 2: /* aifc */
-            WriteAifc(out,(batch_last-batch_first+1)*CD_FRAMESIZE_RAW);
-            break;
-          case 3: /* aiff */
-            WriteAiff(out,(batch_last-batch_first+1)*CD_FRAMESIZE_RAW);
-            break;
-        }
+        for(i=0;i<output_count;i++)
+          output_open(outputs+i,batch,batch_track,
+              (batch_last-batch_first+1)*CD_FRAMESIZE_RAW,
+              output_buffer,output_flags);
 
         /* Off we go! */
 
         if(offset_buffer_used){
           /* partial sector from previous batch read */
           cursor++;
-          if(buffering_write(out,
-                ((char *)offset_buffer)+offset_buffer_used,
-                CD_FRAMESIZE_RAW-offset_buffer_used)){
-            report("Error writing output: %s",strerror(errno));
-            exit(1);
-          }
+          output_write(offset_buffer,1,offset_buffer_used,
+              CD_FRAMESIZE_RAW-offset_buffer_used);
         }
 
         skipped_flag=0;
         while(cursor<=batch_last){
-          /* read a sector */
-          int16_t *readbuf=paranoia_read_limited(p,callback,max_retries);
+          /* read a sector, and any after it that are already verified */
+          long sectors;
+          int16_t *readbuf=paranoia_read_span(p,callback,max_retries,
+              batch_last-cursor+1,&sectors);
           char *err=cdda_errors(d);
           char *mes=cdda_messages(d);
 
@@ -1518,30 +1734,18 @@ int main(int argc,char *argv[]){
           }
 
           skipped_flag=0;
-          cursor++;
-
-          if(output_endian!=bigendianp()){
-            int i;
-            for(i=0;i<CD_FRAMESIZE_RAW/2;i++)readbuf[i]=swap16(readbuf[i]);
-          }
+          cursor+=sectors;
 
           callback(cursor*(CD_FRAMEWORDS)-1,-2);
 
-          if(buffering_write(out,((char *)readbuf)+offset_skip,
-                CD_FRAMESIZE_RAW-offset_skip)){
-            report("Error writing output: %s",strerror(errno));
-            exit(1);
-          }
+          /* write straight from the library's buffer unless it needs
+             swapping */
+          output_write(readbuf,sectors,offset_skip,
+              sectors*CD_FRAMESIZE_RAW-offset_skip);
           offset_skip=0;
 
-          if(output_endian!=bigendianp()){
-            int i;
-            for(i=0;i<CD_FRAMESIZE_RAW/2;i++)readbuf[i]=swap16(readbuf[i]);
-          }
-
           /* One last bit of silliness to deal with sample offsets */
           if(sample_offset && cursor>batch_last){
-            int i;
             /* read a sector and output the partial offset.  Save the
                rest for the next batch iteration */
             readbuf=paranoia_read_limited(p,callback,max_retries);
@@ -1563,28 +1767,17 @@ int main(int argc,char *argv[]){
             skipped_flag=0;
             /* do not move the cursor */
 
-            if(output_endian!=bigendianp())
-              for(i=0;i<CD_FRAMESIZE_RAW/2;i++)
-                offset_buffer[i]=swap16(readbuf[i]);
-            else
-              memcpy(offset_buffer,readbuf,CD_FRAMESIZE_RAW);
+            memcpy(offset_buffer,readbuf,CD_FRAMESIZE_RAW);
             offset_buffer_used=sample_offset*4;
 
             callback(cursor*(CD_FRAMEWORDS),-2);
 
-            if(buffering_write(out,(char *)offset_buffer,
-                  offset_buffer_used)){
-              report("Error writing output: %s",strerror(errno));
-              exit(1);
-            }
+            output_write(offset_buffer,1,0,offset_buffer_used);
           }
         }
         callback(cursor*(CD_FRAMESIZE_RAW/2)-1,-1);
-        buffering_close(out);
+        output_close(skipped_flag);
         if(skipped_flag){
-          /* remove the file */
-          report("\nRemoving aborted file: %s",outfile_name);
-          unlink(outfile_name);
           /* make the cursor correct if we have another track */
           if(batch_track!=-1){
             batch_track++;
@@ -1597,6 +1790,15 @@ int main(int argc,char *argv[]){
         report("\n");
       }
 
+      if(verbose){
+        paranoia_stats st;
+        paranoia_statistics(p,&st);
+        report("Cache buffers: %ld allocated, %ld freed, %ld reads\n",
+            st.slab_allocs,st.slab_releases,st.slab_borrows);
+        report("Index tiles: %ld spanned, %ld searched, %ld built, "
+            "%ld reused\n",st.tiles_spanned,st.tiles_queried,
+            st.tiles_built,st.tiles_reused);
+      }
       paranoia_free(p);
       p=NULL;
     }
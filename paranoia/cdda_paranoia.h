@@ -38,6 +38,18 @@
 typedef void cdrom_paranoia;
 #endif
 
+/* counts kept as the rip goes; see paranoia_statistics() */
+typedef struct paranoia_stats{
+  long slab_allocs;     /* c_block buffers obtained from the system, */
+  long slab_releases;   /* ...given back to it, */
+  long slab_borrows;    /* ...and handed out for reads */
+
+  long tiles_spanned;   /* sample index tiles in the ranges to index, */
+  long tiles_queried;   /* ...looked at by searches, */
+  long tiles_built;     /* ...indexed, */
+  long tiles_reused;    /* ...and carried over unchanged */
+} paranoia_stats;
+
 #include <stdio.h>
 
 extern char *paranoia_version();
@@ -46,7 +58,12 @@ extern void paranoia_modeset(cdrom_paranoia *p,int mode);
 extern long paranoia_seek(cdrom_paranoia *p,long seek,int mode);
 extern int16_t *paranoia_read(cdrom_paranoia *p,void(*callback)(long,int));
 extern int16_t *paranoia_read_limited(cdrom_paranoia *p,void(*callback)(long,int),int maxretries);
+extern int16_t *paranoia_read_span(cdrom_paranoia *p,void(*callback)(long,int),int maxretries,long maxsectors,long *sectors);
 extern void paranoia_free(cdrom_paranoia *p);
 extern void paranoia_overlapset(cdrom_paranoia *p,long overlap);
 extern int paranoia_cachemodel_size(cdrom_paranoia *p,int sectors);
+extern int paranoia_readahead(cdrom_paranoia *p,int enable);
+extern int paranoia_threads(cdrom_paranoia *p,int threads);
+extern int paranoia_adaptive_reads(cdrom_paranoia *p,int enable);
+extern void paranoia_statistics(cdrom_paranoia *p,paranoia_stats *s);
 #endif
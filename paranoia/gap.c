@@ -9,10 +9,14 @@
 #include "p_block.h"
 #include "cdda_paranoia.h"
 #include "gap.h"
+#include "runs.h"
 #include <string.h>
 
 /**** Gap analysis code ***************************************************/
 
+/* tentative rift sizes tried at once by i_analyze_rift_[rf] */
+#define RIFT_STEP 64
+
 /* ===========================================================================
  * i_paranoia_overlap_r (internal)
  *
@@ -28,16 +32,10 @@
  */
 long i_paranoia_overlap_r(int16_t *buffA,int16_t *buffB,
 			  long offsetA, long offsetB){
-  long beginA=offsetA;
-  long beginB=offsetB;
-
   /* Start at the given offsets and work our way backwards until we hit
    * the beginning of one of the vectors.
    */
-  for(;beginA>=0 && beginB>=0;beginA--,beginB--)
-    if(buffA[beginA]!=buffB[beginB])break;
-
-  return(offsetA-beginA);
+  return(i_run_r(buffA+offsetA,buffB+offsetB,min(offsetA,offsetB)+1));
 }
 
 
@@ -57,16 +55,11 @@ long i_paranoia_overlap_r(int16_t *buffA,int16_t *buffB,
 long i_paranoia_overlap_f(int16_t *buffA,int16_t *buffB,
 			  long offsetA, long offsetB,
 			  long sizeA,long sizeB){
-  long endA=offsetA;
-  long endB=offsetB;
-  
   /* Start at the given offsets and work our way forward until we hit
    * the end of one of the vectors.
    */
-  for(;endA<sizeA && endB<sizeB;endA++,endB++)
-    if(buffA[endA]!=buffB[endB])break;
-  
-  return(endA-offsetA);
+  return(i_run_f(buffA+offsetA,buffB+offsetB,
+		 min(sizeA-offsetA,sizeB-offsetB)));
 }
 
 
@@ -174,52 +167,62 @@ void i_analyze_rift_f(int16_t *A,int16_t *B,
    * to fix the rift.
    */
   
-  for(i=1;;i++){
+  for(i=1;i<apast || i<bpast;i+=RIFT_STEP){
     /* Search for whatever case we hit first, so as to end up with the
-     * smallest rift.
+     * smallest rift.  Rather than one tentative rift size at a time, we
+     * try the next RIFT_STEP sizes for each case at once (see runs.c),
+     * and keep the smallest size that matches.  Among equal sizes, the
+     * case tested first below wins, just as if the sizes were tried
+     * one by one.
+     *
+     * A case can only match where MIN_WORDS_RIFT samples of both
+     * vectors remain past the rift, which is what bounds each search
+     * to the ends of A and B.
      */
+    long end1=min(i+RIFT_STEP,bpast-MIN_WORDS_RIFT+1);
+    long end2=min(i+RIFT_STEP,apast-MIN_WORDS_RIFT+1);
+    long best=i+RIFT_STEP;
+    long j;
 
-    /* Don't search for (1) past the end of B */
-    if(i<bpast)
+    /* See if we match case (1) above, which either means that A dropped
+     * samples at the rift, or that B stuttered.
+     */
+    if(apast>=MIN_WORDS_RIFT && end1>i){
+      j=i_run_find_f(A+aoffset,B+boffset+i,end1-i,MIN_WORDS_RIFT);
+      if(j>=0){
+	best=i+j;
+	*matchA=best;
+      }
+    }
 
-      /* See if we match case (1) above, which either means that A dropped
-       * samples at the rift, or that B stuttered.
-       */
-      if(i_paranoia_overlap_f(A,B,aoffset,boffset+i,sizeA,sizeB)>=MIN_WORDS_RIFT){
-	*matchA=i;
-	break;
+    /* See if we match case (2) above, which either means that B dropped
+     * samples at the rift, or that A stuttered.
+     */
+    if(bpast>=MIN_WORDS_RIFT && min(end2,best)>i){
+      j=i_run_find_f(B+boffset,A+aoffset+i,min(end2,best)-i,MIN_WORDS_RIFT);
+      if(j>=0){
+	best=i+j;
+	*matchA=0;
+	*matchB=best;
       }
-    
-    /* Don't search for (2) or (3) past the end of A */
-    if(i<apast){
+    }
 
-      /* See if we match case (2) above, which either means that B dropped
-       * samples at the rift, or that A stuttered.
-       */
-      if(i_paranoia_overlap_f(A,B,aoffset+i,boffset,sizeA,sizeB)>=MIN_WORDS_RIFT){
-	*matchB=i;
-	break;
+    /* See if we match case (3) above, which means that a fixed-length
+     * rift of samples is getting read unreliably.
+     */
+    if(min(min(end1,end2),best)>i){
+      j=i_run_sync_f(A+aoffset+i,B+boffset+i,min(min(end1,end2),best)-i,
+		     MIN_WORDS_RIFT);
+      if(j>=0){
+	*matchA=0;
+	*matchB=0;
+	*matchC=i+j;
       }
+    }
+
+    if(*matchA || *matchB || *matchC)break;
 
-      /* Don't search for (3) past the end of B */
-      if(i<bpast)
-
-        /* See if we match case (3) above, which means that a fixed-length
-         * rift of samples is getting read unreliably.
-         */
-	if(i_paranoia_overlap_f(A,B,aoffset+i,boffset+i,sizeA,sizeB)>=MIN_WORDS_RIFT){
-	  *matchC=i;
-	  break;
-	}
-    }else
-
-      /* Stop searching when we've reached the end of both vectors.
-       * In theory we could stop when there aren't MIN_WORDS_RIFT samples
-       * left in both vectors, but this case should happen fairly rarely.
-       */
-      if(i>=bpast)break;
-    
-    /* Try the search again with a larger tentative rift. */
+    /* Try the search again with larger tentative rifts. */
   }
   
   if(*matchA==0 && *matchB==0 && *matchC==0)return;
@@ -329,52 +332,55 @@ void i_analyze_rift_r(int16_t *A,int16_t *B,
    * to fix the rift.
    */
   
-  for(i=1;;i++){
+  for(i=1;i<apast || i<bpast;i+=RIFT_STEP){
     /* Search for whatever case we hit first, so as to end up with the
-     * smallest rift.
+     * smallest rift.  As in i_analyze_rift_f(), the next RIFT_STEP
+     * sizes are tried for each case at once.
      */
+    long end1=min(i+RIFT_STEP,bpast-MIN_WORDS_RIFT+1);
+    long end2=min(i+RIFT_STEP,apast-MIN_WORDS_RIFT+1);
+    long best=i+RIFT_STEP;
+    long j;
 
-    /* Don't search for (1) past the beginning of B */
-    if(i<bpast)
+    /* See if we match case (1) above, which either means that A dropped
+     * samples at the rift, or that B stuttered.
+     */
+    if(apast>=MIN_WORDS_RIFT && end1>i){
+      j=i_run_find_r(A+aoffset,B+boffset-i,end1-i,MIN_WORDS_RIFT);
+      if(j>=0){
+	best=i+j;
+	*matchA=best;
+      }
+    }
 
-      /* See if we match case (1) above, which either means that A dropped
-       * samples at the rift, or that B stuttered.
-       */
-      if(i_paranoia_overlap_r(A,B,aoffset,boffset-i)>=MIN_WORDS_RIFT){
-	*matchA=i;
-	break;
+    /* See if we match case (2) above, which either means that B dropped
+     * samples at the rift, or that A stuttered.
+     */
+    if(bpast>=MIN_WORDS_RIFT && min(end2,best)>i){
+      j=i_run_find_r(B+boffset,A+aoffset-i,min(end2,best)-i,MIN_WORDS_RIFT);
+      if(j>=0){
+	best=i+j;
+	*matchA=0;
+	*matchB=best;
       }
+    }
 
-    /* Don't search for (2) or (3) past the beginning of A */
-    if(i<apast){
+    /* See if we match case (3) above, which means that a fixed-length
+     * rift of samples is getting read unreliably.
+     */
+    if(min(min(end1,end2),best)>i){
+      j=i_run_sync_r(A+aoffset-i,B+boffset-i,min(min(end1,end2),best)-i,
+		     MIN_WORDS_RIFT);
+      if(j>=0){
+	*matchA=0;
+	*matchB=0;
+	*matchC=i+j;
+      }
+    }
 
-      /* See if we match case (2) above, which either means that B dropped
-       * samples at the rift, or that A stuttered.
-       */
-      if(i_paranoia_overlap_r(A,B,aoffset-i,boffset)>=MIN_WORDS_RIFT){
-	*matchB=i;
-	break;
-      }      
-
-      /* Don't search for (3) past the beginning of B */
-      if(i<bpast)
-
-	/* See if we match case (3) above, which means that a fixed-length
-	 * rift of samples is getting read unreliably.
-	 */
-	if(i_paranoia_overlap_r(A,B,aoffset-i,boffset-i)>=MIN_WORDS_RIFT){
-	  *matchC=i;
-	  break;
-	}
-    }else
-
-      /* Stop searching when we've reached the end of both vectors.
-       * In theory we could stop when there aren't MIN_WORDS_RIFT samples
-       * left in both vectors, but this case should happen fairly rarely.
-       */
-      if(i>=bpast)break;
-    
-    /* Try the search again with a larger tentative rift. */
+    if(*matchA || *matchB || *matchC)break;
+
+    /* Try the search again with larger tentative rifts. */
   }
   
   if(*matchA==0 && *matchB==0 && *matchC==0)return;
@@ -500,3 +506,225 @@ void  analyze_rift_silence_f(int16_t *A,int16_t *B,long sizeA,long sizeB,
     boffset++;
   }
 }
+
+#ifdef TEST
+
+/* 'make gap.t': checks i_analyze_rift_[fr] against the analyzers they
+ * replaced, which tried one rift size at a time with a plain sample
+ * loop, on synthetic rifts (as many as the first argument says), then
+ * times both on rifts of a few sizes.  The timings only mean something
+ * built with optimization, e.g. 'make gap.t DEBUG=-O2'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_SIZE   2048
+#define TEST_PAD    8192  /* i_stutter_or_gap() may look past the ends */
+#define TEST_CASES  20000
+
+static long overlap_f_ref(int16_t *A,int16_t *B,long offA,long offB,
+			  long sizeA,long sizeB){
+  long n=0;
+  while(offA+n<sizeA && offB+n<sizeB && A[offA+n]==B[offB+n])n++;
+  return(n);
+}
+
+static long overlap_r_ref(int16_t *A,int16_t *B,long offA,long offB){
+  long n=0;
+  while(offA-n>=0 && offB-n>=0 && A[offA-n]==B[offB-n])n++;
+  return(n);
+}
+
+static void rift_f_ref(int16_t *A,int16_t *B,long sizeA,long sizeB,
+		       long aoffset,long boffset,
+		       long *matchA,long *matchB,long *matchC){
+  long apast=sizeA-aoffset;
+  long bpast=sizeB-boffset;
+  long i;
+
+  *matchA=0, *matchB=0, *matchC=0;
+  for(i=1;;i++){
+    if(i<bpast &&
+       overlap_f_ref(A,B,aoffset,boffset+i,sizeA,sizeB)>=MIN_WORDS_RIFT){
+      *matchA=i;
+      break;
+    }
+    if(i<apast){
+      if(overlap_f_ref(A,B,aoffset+i,boffset,sizeA,sizeB)>=MIN_WORDS_RIFT){
+	*matchB=i;
+	break;
+      }
+      if(i<bpast &&
+	 overlap_f_ref(A,B,aoffset+i,boffset+i,sizeA,sizeB)>=MIN_WORDS_RIFT){
+	*matchC=i;
+	break;
+      }
+    }else if(i>=bpast)break;
+  }
+
+  if(*matchA==0 && *matchB==0 && *matchC==0)return;
+  if(*matchC)return;
+  if(*matchA){
+    if(i_stutter_or_gap(A,B,aoffset-*matchA,boffset,*matchA))return;
+    *matchB=-*matchA;
+    *matchA=0;
+  }else{
+    if(i_stutter_or_gap(B,A,boffset-*matchB,aoffset,*matchB))return;
+    *matchA=-*matchB;
+    *matchB=0;
+  }
+}
+
+static void rift_r_ref(int16_t *A,int16_t *B,long sizeA,long sizeB,
+		       long aoffset,long boffset,
+		       long *matchA,long *matchB,long *matchC){
+  long apast=aoffset+1;
+  long bpast=boffset+1;
+  long i;
+
+  *matchA=0, *matchB=0, *matchC=0;
+  for(i=1;;i++){
+    if(i<bpast && overlap_r_ref(A,B,aoffset,boffset-i)>=MIN_WORDS_RIFT){
+      *matchA=i;
+      break;
+    }
+    if(i<apast){
+      if(overlap_r_ref(A,B,aoffset-i,boffset)>=MIN_WORDS_RIFT){
+	*matchB=i;
+	break;
+      }
+      if(i<bpast && overlap_r_ref(A,B,aoffset-i,boffset-i)>=MIN_WORDS_RIFT){
+	*matchC=i;
+	break;
+      }
+    }else if(i>=bpast)break;
+  }
+
+  if(*matchA==0 && *matchB==0 && *matchC==0)return;
+  if(*matchC)return;
+  if(*matchA){
+    if(i_stutter_or_gap(A,B,aoffset+1,boffset-*matchA+1,*matchA))return;
+    *matchB=-*matchA;
+    *matchA=0;
+  }else{
+    if(i_stutter_or_gap(B,A,boffset+1,aoffset-*matchB+1,*matchB))return;
+    *matchA=-*matchB;
+    *matchB=0;
+  }
+}
+
+static double now(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return(t.tv_sec+t.tv_nsec*1e-9);
+}
+
+/* Fills A with (size) samples of audio (full scale, or noise of the
+ * given level), and B with the same but for a rift at (at): (kind) 0
+ * drops (rift) samples from B, 1 inserts that many of garbage, 2
+ * replaces that many with garbage.  Returns, in (edgeA,edgeB), where
+ * the two agree again past the rift.
+ */
+static void make_rift(int16_t *A,int16_t *B,long size,int level,
+		      long at,long rift,int kind,long *edgeA,long *edgeB){
+  long j,k;
+
+  for(j=0;j<size;j++)
+    A[j]=(level?rand()%(2*level+1)-level:rand()-RAND_MAX/2);
+  for(j=0,k=0;k<size;j++){
+    if(j==at && kind==1){
+      long g;
+      for(g=0;g<rift && k<size;g++)B[k++]=rand();
+    }
+    if(j>=at && j<at+rift && kind==0)continue;
+    if(j>=size)B[k++]=rand();
+    else B[k++]=(j>=at && j<at+rift && kind==2 ? rand() : A[j]);
+  }
+  *edgeA=at+(kind==1?0:rift);
+  *edgeB=at+(kind==0?0:rift);
+}
+
+static void check(char *what,long c,long *got,long *want){
+  if(got[0]!=want[0] || got[1]!=want[1] || got[2]!=want[2]){
+    fprintf(stderr,"%s, case %ld: %ld/%ld/%ld, was %ld/%ld/%ld\n",what,c,
+	    got[0],got[1],got[2],want[0],want[1],want[2]);
+    exit(1);
+  }
+}
+
+int main(int argc,char **argv){
+  int16_t *bufA=calloc(TEST_SIZE*4+TEST_PAD*2,sizeof(*bufA));
+  int16_t *bufB=calloc(TEST_SIZE*4+TEST_PAD*2,sizeof(*bufB));
+  int16_t *A=bufA+TEST_PAD,*B=bufB+TEST_PAD;
+  long cases=(argc>1?atol(argv[1]):TEST_CASES);
+  long c,n=TEST_SIZE;
+  long sizes[]={16,256,1000,5000};
+  unsigned int s;
+
+  srand(0);
+  for(c=0;c<cases;c++){
+    long rift=rand()%300+1;
+    long at=n/2-rift/2;
+    long edgeA,edgeB,aoff,boff;
+    long got[3],want[3];
+
+    make_rift(A,B,n,(rand()&1?0:rand()%3+1),at,rift,rand()%3,&edgeA,&edgeB);
+
+    /* the trailing rift starts at (at) in both; the leading one ends
+       just before the edges; one case in four starts somewhere else */
+    aoff=boff=at;
+    if((rand()&3)==0){
+      aoff=rand()%n;
+      boff=rand()%n;
+    }
+    i_analyze_rift_f(A,B,n,n,aoff,boff,got,got+1,got+2);
+    rift_f_ref(A,B,n,n,aoff,boff,want,want+1,want+2);
+    check("i_analyze_rift_f",c,got,want);
+
+    aoff=edgeA-1;
+    boff=edgeB-1;
+    if((rand()&3)==0){
+      aoff=rand()%n;
+      boff=rand()%n;
+    }
+    i_analyze_rift_r(A,B,n,n,aoff,boff,got,got+1,got+2);
+    rift_r_ref(A,B,n,n,aoff,boff,want,want+1,want+2);
+    check("i_analyze_rift_r",c,got,want);
+  }
+  printf("%ld synthetic rifts: i_analyze_rift_[fr] agree with the "
+	 "one-size-at-a-time search\n",cases);
+
+  /* samples dropped from B, in full-scale audio; the old search also
+     ran each overlap it found out to its end, so its time depends on
+     how much agrees past the rift as well as on the rift's size */
+  n=TEST_SIZE*4;
+  for(s=0;s<sizeof(sizes)/sizeof(*sizes);s++){
+    long edgeA,edgeB,m[3],reps=0;
+    double t0,t1,t2;
+
+    make_rift(A,B,n,0,MIN_WORDS_RIFT,sizes[s],0,&edgeA,&edgeB);
+    t0=now();
+    do{
+      i_analyze_rift_f(A,B,n,n,MIN_WORDS_RIFT,MIN_WORDS_RIFT,m,m+1,m+2);
+      reps++;
+    }while((t1=now())-t0<.2);
+    t1=(t1-t0)/reps;
+    t0=now();
+    reps=0;
+    do{
+      rift_f_ref(A,B,n,n,MIN_WORDS_RIFT,MIN_WORDS_RIFT,m,m+1,m+2);
+      reps++;
+    }while((t2=now())-t0<.2);
+    t2=(t2-t0)/reps;
+    printf("rift %5ld: %8.2f us a call, was %8.2f us\n",
+	   sizes[s],t1*1e6,t2*1e6);
+  }
+
+  free(bufA);
+  free(bufB);
+  return(0);
+}
+
+#endif
@@ -18,6 +18,25 @@
  * Collisions aren't due to hash collisions, as the table has one bucket
  * for each possible sample value.  Instead, the "collisions" represent
  * multiple occurrences of a given value.
+ *
+ * The SORT_FLAT layout holds the same information without the lists.
+ * The indexed range is cut into tiles at fixed absolute positions, and
+ * each tile is a packed array of (value, offset) keys in ascending
+ * order, so the occurrences of a value are contiguous and in position
+ * order.  The first hit at or after a position is a binary search
+ * away, and walking the remaining hits is a pointer increment instead
+ * of a cache miss per hop.
+ *
+ * Because tiles are keyed by absolute position, they also make the
+ * index a sliding window: consecutive reads cover mostly the same
+ * absolute range, and a tile whose samples haven't changed (checked
+ * by fingerprint) needn't be rebuilt for the next vector.
+ *
+ * Either layout can key on a run of samples instead of a single one
+ * (see sort_setwidth()).  The key is then a 16-bit hash of the run
+ * starting at each position, so it still fits the 65536 buckets and
+ * the 16 value bits of a tile key.  A hash collision only costs a
+ * wasted candidate, since the caller compares the samples anyway.
  */
 
 #include <stdlib.h>
@@ -26,6 +45,43 @@
 #include "isort.h"
 
 
+/* ===========================================================================
+ * sort_tiles_alloc() (internal)
+ *
+ * Allocates the ring of SORT_FLAT tiles for the object's maximum size
+ * and tile size.
+ */
+
+static void sort_tiles_alloc(sort_info *i){
+  long words=1L<<i->tilebits;
+  long tiles=1,j;
+
+  /* A window of (maxsize) samples at any alignment touches at most
+   * maxsize/words+2 tiles; round up to a power of two so the ring can
+   * be indexed by masking the tag.
+   */
+  while(tiles<i->maxsize/words+2)tiles<<=1;
+
+  i->tiles=calloc(tiles,sizeof(sort_tile));
+  i->tilemask=tiles-1;
+  for(j=0;j<tiles;j++){
+    i->tiles[j].keys=malloc(words*sizeof(u_int32_t));
+    i->tiles[j].gen=-1;
+  }
+  i->scratch=malloc(2*words*sizeof(u_int32_t));
+}
+
+/* ...and frees it */
+static void sort_tiles_free(sort_info *i){
+  long j;
+
+  for(j=0;j<=i->tilemask;j++)
+    free(i->tiles[j].keys);
+  free(i->tiles);
+  free(i->scratch);
+}
+
+
 /* ===========================================================================
  * sort_alloc()
  *
@@ -33,23 +89,68 @@
  * used to index up to (size) samples from a vector.
  */
 
-sort_info *sort_alloc(long size){
+sort_info *sort_alloc(long size,int mode){
   sort_info *ret=calloc(1,sizeof(sort_info));
 
   ret->vector=NULL;
   ret->sortbegin=-1;
   ret->size=-1;
   ret->maxsize=size;
+  ret->mode=mode;
+  ret->width=1;
 
-  ret->head=calloc(65536,sizeof(sort_link *));
   ret->bucketusage=malloc(65536*sizeof(long));
-  ret->revindex=calloc(size,sizeof(sort_link));
   ret->lastbucket=0;
 
+  if(mode==SORT_FLAT){
+    ret->tilebits=SORT_TILE_BITS;
+    sort_tiles_alloc(ret);
+  }else{
+    ret->head=calloc(65536,sizeof(sort_link *));
+    ret->revindex=calloc(size,sizeof(sort_link));
+  }
+
   return(ret);
 }
 
 
+/* ===========================================================================
+ * sort_setwidth()
+ *
+ * Sets the number of consecutive samples making up each key.  Existing
+ * tiles were built with the old keys, so none of them can be reused.
+ */
+
+void sort_setwidth(sort_info *i,int width){
+  long j;
+
+  if(i->sortbegin!=-1)sort_unsortall(i);
+  if(i->tiles)
+    for(j=0;j<=i->tilemask;j++)
+      i->tiles[j].gen=-1;
+
+  i->width=max(width,1);
+}
+
+
+/* ===========================================================================
+ * sort_settiles()
+ *
+ * Sets the size of SORT_FLAT tiles to (1<<bits) samples.  The ring of
+ * tiles is allocated again for the new size, so any existing index is
+ * discarded.
+ */
+
+void sort_settiles(sort_info *i,int bits){
+  if(i->mode!=SORT_FLAT)return;
+  if(i->sortbegin!=-1)sort_unsortall(i);
+
+  sort_tiles_free(i);
+  i->tilebits=min(max(bits,1),16);
+  sort_tiles_alloc(i);
+}
+
+
 /* ===========================================================================
  * sort_unsortall() (internal)
  *
@@ -64,12 +165,19 @@ void sort_unsortall(sort_info *i){
    * zero out all buckets with a memset() rather than walking the data
    * structure and zeroing them out one by one.
    */
-  if(i->lastbucket>2000){ /* a guess */
-    memset(i->head,0,65536*sizeof(sort_link *));
+  if(i->mode==SORT_FLAT){
+    /* Nothing to clear; moving to a new generation retires every tile,
+     * though each keeps its contents in case sort_sort() can reuse it.
+     */
+    i->gen++;
   }else{
-    long b;
-    for(b=0;b<i->lastbucket;b++)
-      i->head[i->bucketusage[b]]=NULL;
+    if(i->lastbucket>2000){ /* a guess */
+      memset(i->head,0,65536*sizeof(sort_link *));
+    }else{
+      long b;
+      for(b=0;b<i->lastbucket;b++)
+	i->head[i->bucketusage[b]]=NULL;
+    }
   }
 
   i->lastbucket=0;
@@ -89,13 +197,160 @@ void sort_unsortall(sort_info *i){
  */
 
 void sort_free(sort_info *i){
-  free(i->revindex);
-  free(i->head);
+  if(i->tiles)sort_tiles_free(i);
+  if(i->revindex)free(i->revindex);
+  if(i->head)free(i->head);
   free(i->bucketusage);
   free(i);
 }
  
 
+/* ===========================================================================
+ * sort_key() (internal)
+ *
+ * Returns the key (0 to 65535) of the (n) samples at (v).  A single
+ * sample is its own key, offset to be unsigned, so that the index
+ * behaves exactly as it always has with a key width of 1.
+ */
+
+static inline long sort_key(int16_t *v,long n){
+  unsigned long long h=0;
+  long j;
+
+  if(n==1)return(v[0]+32768);
+  for(j=0;j<n;j++)
+    h=(h+(u_int16_t)v[j])*0x9E3779B97F4A7C15ULL;
+  return((long)(h>>48));
+}
+
+
+/* ===========================================================================
+ * sort_print() (internal)
+ *
+ * Fingerprints (n) samples for sort_tile_get(), which uses it to decide
+ * whether an existing tile still describes the samples it would cover.
+ */
+
+static unsigned long long sort_print(int16_t *v,long n){
+  unsigned long long h=n*0x9E3779B97F4A7C15ULL;
+  long j;
+
+  /* four samples at a time; only equality matters, not byte order */
+  for(j=0;j+4<=n;j+=4){
+    unsigned long long x;
+    memcpy(&x,v+j,sizeof(x));
+    h=(h^x)*0x9E3779B97F4A7C15ULL;
+    h^=h>>29;
+  }
+  for(;j<n;j++){
+    h=(h^(u_int16_t)v[j])*0x9E3779B97F4A7C15ULL;
+    h^=h>>29;
+  }
+  return(h);
+}
+
+
+/* ===========================================================================
+ * sort_tile_build() (internal)
+ *
+ * Indexes the samples of tile (t) from absolute position (begin) to (end).
+ * The keys start out in position order; two stable radix passes on the
+ * low and high byte of the value then leave them sorted by value, and
+ * by position within each value.
+ */
+
+static void sort_tile_build(sort_info *i,sort_tile *t,long begin,long end){
+  int16_t *v=i->vector+(begin-ib(i));
+  long base=begin-t->tag*(1L<<i->tilebits);
+  long n=end-begin,j,b,s0=0,s1=0;
+  long h0[256],h1[256];
+  u_int32_t *a=i->scratch;
+  u_int32_t *c=i->scratch+(1L<<i->tilebits);
+
+  memset(h0,0,sizeof(h0));
+  memset(h1,0,sizeof(h1));
+  for(j=0;j<n;j++){
+    u_int32_t key=((u_int32_t)sort_key(v+j,i->width)<<16)|(base+j);
+    a[j]=key;
+    h0[(key>>16)&255]++;
+    h1[key>>24]++;
+  }
+  for(b=0;b<256;b++){
+    long x=h0[b];
+    h0[b]=s0;
+    s0+=x;
+    x=h1[b];
+    h1[b]=s1;
+    s1+=x;
+  }
+  for(j=0;j<n;j++)c[h0[(a[j]>>16)&255]++]=a[j];
+  for(j=0;j<n;j++)t->keys[h1[c[j]>>24]++]=c[j];
+
+  t->used=n;
+  i->tilesbuilt++;
+}
+
+
+/* ===========================================================================
+ * sort_sort_flat() (internal)
+ *
+ * sort_sort() for the SORT_FLAT layout.  Nothing is indexed yet; tiles
+ * are only built when a query first looks at them (see sort_tile_get()),
+ * so parts of the range no query reaches are never indexed at all.
+ */
+
+static void sort_sort_flat(sort_info *i,long sortlo,long sorthi){
+  i->sortlo=sortlo;
+  i->sorthi=sorthi;
+  if(sortlo<sorthi)
+    i->tilesspanned+=((sorthi-1+ib(i))>>i->tilebits)-
+      ((sortlo+ib(i))>>i->tilebits)+1;
+
+  /* Tiles are keyed by absolute position, so remember where the vector
+   * was when they were checked; drift compensation can move it.
+   */
+  i->sortpos=ib(i);
+  i->sortbegin=0;
+}
+
+
+/* ===========================================================================
+ * sort_tile_get() (internal)
+ *
+ * Returns tile (tag), indexing it first if it hasn't been used since the
+ * last sort_setup().  A tile left over from an earlier vector is reused
+ * if it covers the same absolute range and the samples in it are
+ * unchanged; otherwise it is rebuilt.  Returns NULL if the tile lies
+ * outside the range to index.
+ */
+
+static sort_tile *sort_tile_get(sort_info *i,long tag){
+  sort_tile *t=i->tiles+(tag&i->tilemask);
+  long begin=max(i->sortlo+ib(i),tag*(1L<<i->tilebits));
+  long end=min(i->sorthi+ib(i),(tag+1)*(1L<<i->tilebits));
+  unsigned long long print;
+
+  if(t->gen==i->gen && t->tag==tag)return(t);
+  if(begin>=end)return(NULL);
+
+  /* the keys of the last few positions reach past the tile */
+  print=sort_print(i->vector+(begin-ib(i)),end-begin+i->width-1);
+
+  if(t->gen!=-1 && t->tag==tag && t->begin==begin && t->end==end &&
+     t->print==print){
+    i->tilesreused++;
+  }else{
+    t->tag=tag;
+    t->begin=begin;
+    t->end=end;
+    t->print=print;
+    sort_tile_build(i,t,begin,end);
+  }
+  t->gen=i->gen;
+  return(t);
+}
+
+
 /* ===========================================================================
  * sort_sort() (internal)
  *
@@ -107,32 +362,42 @@ void sort_free(sort_info *i){
 static void sort_sort(sort_info *i,long sortlo,long sorthi){
   long j;
 
+  /* Only positions with a full key's worth of samples after them are
+   * indexed; sort_getmatch() scans for the rest.
+   */
+  sorthi=min(sorthi,i->size-i->width+1);
+
+  if(i->mode==SORT_FLAT){
+    sort_sort_flat(i,sortlo,sorthi);
+    return;
+  }
+
   /* We walk backward through the range to index because we insert new
    * samples at the head of each bucket's list.  At the end, they'll be
    * sorted from first to last occurrence.
    */
   for(j=sorthi-1;j>=sortlo;j--){
-    /* i->vector[j] = the signed 16-bit sample to index.
+    /* key          = the key of the sample(s) to index.  With a key
+     *                width of 1, this is the signed 16-bit sample plus
+     *                32768, converting it to a range from 0 to 65535.
      * hv           = pointer to the head of the sorted list of occurences
-     *                of this sample
+     *                of this key
      * l            = the node to associate with this sample
      *
-     * We add 32768 to convert the signed 16-bit integer to an unsigned
-     * range from 0 to 65535.
-     *
      * Note that l is located within i->revindex at a position
      * corresponding to the sample's position in the vector.  This allows
      * ipos() to determine the sample position from a returned sort_link.
      */
-    sort_link **hv=i->head+i->vector[j]+32768;
+    long key=sort_key(i->vector+j,i->width);
+    sort_link **hv=i->head+key;
     sort_link *l=i->revindex+j;
 
-    /* If this is the first time we've encountered this sample, add its
+    /* If this is the first time we've encountered this key, add its
      * bucket to the list of buckets used.  This list is used only for
      * resetting the index quickly.
      */
     if(*hv==NULL){
-      i->bucketusage[i->lastbucket]=i->vector[j]+32768;
+      i->bucketusage[i->lastbucket]=key;
       i->lastbucket++;
     }
 
@@ -165,9 +430,10 @@ static void sort_sort(sort_info *i,long sortlo,long sorthi){
 
 void sort_setup(sort_info *i,int16_t *vector,long *abspos,
 		long size,long sortlo,long sorthi){
-  /* Reset the index if it has already been built.
+  /* Reset the index if it has already been built.  SORT_FLAT tiles are
+   * always retired, as sort_update() may have carried some over since.
    */
-  if(i->sortbegin!=-1)sort_unsortall(i);
+  if(i->sortbegin!=-1 || i->mode==SORT_FLAT)sort_unsortall(i);
 
   i->vector=vector;
   i->size=size;
@@ -179,43 +445,173 @@ void sort_setup(sort_info *i,int16_t *vector,long *abspos,
    */
   i->lo=min(size,max(sortlo-*abspos,0));
   i->hi=max(0,min(sorthi-*abspos,size));
+  i->sortlo=i->lo;
+  i->sorthi=i->hi;
 }
 
+/* ===========================================================================
+ * sort_update()
+ *
+ * sort_setup(), where nothing in the vector before the absolute position
+ * (changed) is different from what the object was last set up with.
+ * SORT_FLAT tiles checked since then that lie wholly before (changed)
+ * are carried over as they are, without being fingerprinted again; the
+ * rest are left to sort_tile_get() as usual.  Samples that have moved
+ * (see c_set()) count as altered, as does everything in a different
+ * vector altogether.
+ */
+
+void sort_update(sort_info *i,int16_t *vector,long *abspos,long size,
+		 long sortlo,long sorthi,long changed){
+  long gen=i->gen;
+  long hi,j;
+
+  sort_setup(i,vector,abspos,size,sortlo,sorthi);
+  if(i->mode!=SORT_FLAT)return;
+
+  /* the range sort_sort() will settle on, and so the range each tile
+     would cover */
+  hi=min(i->sorthi,i->size-i->width+1)+ib(i);
+
+  for(j=0;j<=i->tilemask;j++){
+    sort_tile *t=i->tiles+j;
+    long begin=max(i->sortlo+ib(i),t->tag*(1L<<i->tilebits));
+    long end=min(hi,(t->tag+1)*(1L<<i->tilebits));
+
+    /* the keys of the last few positions reach past the tile */
+    if(t->gen==gen && t->begin==begin && t->end==end &&
+       end+i->width-1<=changed){
+      t->gen=i->gen;
+      i->tilesreused++;
+    }
+  }
+}
+
+/* ===========================================================================
+ * sort_tile_match() (internal)
+ *
+ * Finds the first hit for the current query in tile (tag), leaving the
+ * cursor on it for sort_nextmatch().  Returns the hit's offset within
+ * the vector, -1 if the search window ends before the next hit, or -2
+ * if this tile holds no hits at all and the next tile should be tried.
+ */
+
+static long sort_tile_match(sort_info *i,long tag){
+  sort_tile *t=sort_tile_get(i,tag);
+  long base=tag*(1L<<i->tilebits);
+  long lo=i->lo+ib(i)-base;
+  u_int32_t want=((u_int32_t)i->val<<16)|(lo>0?lo:0);
+  u_int32_t *b,*e;
+  long pos;
+
+  i->tilesqueried++;
+  if(t==NULL)return(-2);
+
+  b=t->keys;
+  e=t->keys+t->used;
+  while(b<e){
+    u_int32_t *m=b+((e-b)>>1);
+    if(*m<want)
+      b=m+1;
+    else
+      e=m;
+  }
+
+  if(b>=t->keys+t->used || (*b>>16)!=(u_int32_t)i->val)return(-2);
+
+  pos=base+(*b&0xffff)-ib(i);
+  if(pos>=i->hi)return(-1);
+
+  i->tag=tag;
+  i->cursor=b;
+  i->cursorend=t->keys+t->used;
+  return(pos);
+}
+
+
+/* ===========================================================================
+ * sort_scan() (internal)
+ *
+ * Looks for the current query's first sample from offset (j) up to the
+ * end of the search window, without the index.  This covers the last
+ * few positions of the vector, which are too close to its end to have
+ * a key of their own, and queries too short to form one.
+ */
+
+static long sort_scan(sort_info *i,long j){
+  for(;j<i->scanhi;j++)
+    if(i->vector[j]==i->first)return(j);
+  return(-1);
+}
+
+
 /* ===========================================================================
  * sort_getmatch()
  *
- * This function returns a sort_link_t pointer which refers to the
- * first sample equal to (value) in the vector.  It only searches for
+ * This function returns the position (offset within the vector) of the
+ * first run of samples equal to the (n) samples at (value) in the
+ * vector, the run being as long as the key width.  It only searches for
  * hits within (overlap) samples of (post), where (post) is an offset
- * within the vector.  The caller can determine the position of the
- * matched sample using ipos(sort_info *, sort_link *).
+ * within the vector.
  *
- * This function returns NULL if no matches were found.
+ * This function returns -1 if no matches were found.
  */
 
-sort_link *sort_getmatch(sort_info *i,long post,long overlap,int value){
+long sort_getmatch(sort_info *i,long post,long overlap,
+		   int16_t *value,long n){
   sort_link *ret;
 
-  /* If the vector hasn't been indexed yet, index it now.
+  /* If the vector hasn't been indexed yet, index it now.  If drift
+   * compensation has moved the vector since its tiles were checked,
+   * they no longer line up with it; check them again.
    */
-  if(i->sortbegin==-1)sort_sort(i,i->lo,i->hi);
+  if(i->mode==SORT_FLAT && i->sortbegin!=-1 && i->sortpos!=ib(i)){
+    i->gen++;
+    i->sortbegin=-1;
+  }
+  if(i->sortbegin==-1)sort_sort(i,i->sortlo,i->sorthi);
   /* Now we reuse lo and hi */
   
   /* We'll only return samples within (overlap) samples of (post).
    * Clamp the boundaries to search to the boundaries of the array,
-   * convert the signed sample to an unsigned offset, and store the
+   * work out the key to look for, and store the
    * state so that future calls to sort_nextmatch do the right thing.
    *
    * Reusing lo and hi this way is awful.
    */
   post=max(0,min(i->size,post));
-  i->val=value+32768;
+  i->first=value[0];
   i->lo=max(0,post-overlap);       /* absolute position */
   i->hi=min(i->size,post+overlap); /* absolute position */
 
+  /* Positions from (scan) on have no key in the index; hits there are
+   * found by sort_scan() once the index has run out.  With a key width
+   * of 1 every position has a key and there is nothing to scan.
+   */
+  i->scanhi=i->hi;
+  if(n<i->width){
+    i->scan=i->lo;
+    return(sort_scan(i,i->scan));
+  }
+  i->scan=max(i->lo,i->size-i->width+1);
+  i->hi=min(i->hi,i->scan);
+  i->val=sort_key(value,i->width);
+
+  if(i->mode==SORT_FLAT){
+    long tag;
+
+    if(i->lo>=i->hi)return(sort_scan(i,i->scan));
+    for(tag=(i->lo+ib(i))>>i->tilebits;
+	tag<=(i->hi-1+ib(i))>>i->tilebits;tag++){
+      long ret=sort_tile_match(i,tag);
+      if(ret!=-2)return(ret>=0?ret:sort_scan(i,i->scan));
+    }
+    return(sort_scan(i,i->scan));
+  }
+
   /* Walk through the linked list of samples with this value, until
    * we find the first one within the bounds specified.  If there
-   * aren't any, return NULL.
+   * aren't any, return -1.
    */
   ret=i->head[i->val];
 
@@ -233,28 +629,148 @@ sort_link *sort_getmatch(sort_info *i,long post,long overlap,int value){
     }
   }
   /*i->head[i->val]=ret;*/
-  return(ret);
+  return(ret?ipos(i,ret):sort_scan(i,i->scan));
 }
 
 
 /* ===========================================================================
  * sort_nextmatch()
  *
- * This function returns a sort_link_t pointer which refers to the next sample
- * matching the criteria previously passed to sort_getmatch().  See
- * sort_getmatch() for details.
+ * This function returns the position of the next sample matching the
+ * criteria previously passed to sort_getmatch(), given the position
+ * (prev) it returned last.  See sort_getmatch() for details.
  *
- * This function returns NULL if no further matches were found.
+ * This function returns -1 if no further matches were found.
  */
 
-sort_link *sort_nextmatch(sort_info *i,sort_link *prev){
-  sort_link *ret=prev->next;
+long sort_nextmatch(sort_info *i,long prev){
+  sort_link *ret;
+
+  /* Once the index has run out, the rest of the hits (if any) are
+   * past its end, found by scanning.
+   */
+  if(prev>=i->scan)return(sort_scan(i,prev+1));
 
   /* If there aren't any more hits, or we've passed the boundary requested
    * of sort_getmatch(), we're done.
    */
-  if(!ret || ipos(i,ret)>=i->hi)return(NULL); 
+  if(i->mode==SORT_FLAT){
+    long tag;
 
-  return(ret);
+    /* The rest of this value's hits in the current tile follow the
+     * last one directly; after that, move on to the next tile.
+     */
+    i->cursor++;
+    if(i->cursor<i->cursorend && (*i->cursor>>16)==(u_int32_t)i->val){
+      long pos=(i->tag*(1L<<i->tilebits))+(*i->cursor&0xffff)-ib(i);
+      return(pos<i->hi?pos:sort_scan(i,i->scan));
+    }
+    for(tag=i->tag+1;tag<=(i->hi-1+ib(i))>>i->tilebits;tag++){
+      long ret=sort_tile_match(i,tag);
+      if(ret!=-2)return(ret>=0?ret:sort_scan(i,i->scan));
+    }
+    return(sort_scan(i,i->scan));
+  }
+
+  ret=i->revindex[prev].next;
+  if(!ret || ipos(i,ret)>=i->hi)return(sort_scan(i,i->scan)); 
+
+  return(ipos(i,ret));
+}
+
+#ifdef TEST
+
+/* 'make isort.t': indexes 1200 sectors of synthetic audio with each
+ * layout, checks that both give the same hits for the same lookups,
+ * and times building the index and looking up (as paranoia does,
+ * within dynoverlap of a post and walking up to 8 hits).  Music-like
+ * audio and a quiet passage are tried in turn.  The timings only mean
+ * something built with optimization, e.g. 'make isort.t DEBUG=-O2'.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "cdda_paranoia.h"
+
+#define TEST_SECTORS  1200
+#define TEST_LOOKUPS  200000
+#define TEST_HITS     8
+
+static double now(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return(t.tv_sec+t.tv_nsec*1e-9);
+}
+
+int main(int argc,char **argv){
+  long size=TEST_SECTORS*CD_FRAMEWORDS;
+  long overlap=MAX_SECTOR_OVERLAP*CD_FRAMEWORDS;
+  long lookups=(argc>1?atol(argv[1]):TEST_LOOKUPS);
+  int16_t *v=malloc(size*sizeof(*v));
+  long *post=malloc(lookups*sizeof(*post));
+  long *at=malloc(lookups*sizeof(*at));
+  long *hits[2];
+  long abspos=0,j,k;
+  int quiet,mode;
+
+  hits[0]=malloc(lookups*TEST_HITS*sizeof(**hits));
+  hits[1]=malloc(lookups*TEST_HITS*sizeof(**hits));
+
+  printf("layout  audio   index ms   lookups/s\n");
+  for(quiet=0;quiet<2;quiet++){
+    srand(0);
+    for(j=0;j<size;j++)
+      v[j]=(quiet ? rand()%7-3 :
+	    8000*sin(j*.031)+6000*sin(j*.0071)+rand()%512-256);
+
+    /* look up the samples at (at), somewhere near (post) */
+    for(j=0;j<lookups;j++){
+      post[j]=rand()%size;
+      at[j]=post[j]+rand()%(2*MIN_SECTOR_EPSILON+1)-MIN_SECTOR_EPSILON;
+      at[j]=max(0,min(size-1,at[j]));
+    }
+
+    for(mode=SORT_LINKED;mode<=SORT_FLAT;mode++){
+      sort_info *i=sort_alloc(size,mode);
+      long *h=hits[mode];
+      double t0,t1,t2;
+
+      sort_setwidth(i,MIN_WORDS_KEY);
+      t0=now();
+      sort_setup(i,v,&abspos,size,0,size);
+      /* one lookup per tile, to index all of it either way */
+      for(j=0;j<size;j+=1L<<SORT_TILE_BITS)
+	sort_getmatch(i,j,1L<<SORT_TILE_BITS,v+j,size-j);
+      t1=now();
+      for(j=0;j<lookups;j++){
+	long m=sort_getmatch(i,post[j],overlap,v+at[j],size-at[j]);
+	for(k=0;k<TEST_HITS;k++){
+	  h[j*TEST_HITS+k]=m;
+	  if(m>=0)m=sort_nextmatch(i,m);
+	}
+      }
+      t2=now();
+      printf("%-7s %-7s %8.1f %11.0f\n",mode==SORT_FLAT?"flat":"linked",
+	     quiet?"quiet":"music",(t1-t0)*1e3,lookups/(t2-t1));
+      sort_free(i);
+    }
+
+    for(j=0;j<lookups*TEST_HITS;j++)
+      if(hits[0][j]!=hits[1][j]){
+	fprintf(stderr,"lookup %ld, hit %ld: linked %ld, flat %ld\n",
+		j/TEST_HITS,j%TEST_HITS,hits[0][j],hits[1][j]);
+	exit(1);
+      }
+  }
+  printf("both layouts give the same hits\n");
+
+  free(v);
+  free(post);
+  free(at);
+  free(hits[0]);
+  free(hits[1]);
+  return(0);
 }
 
+#endif
@@ -10,6 +10,27 @@ typedef struct sort_link{
   struct sort_link *next;
 } sort_link;
 
+/* Index layouts, chosen at sort_alloc() time.  SORT_LINKED is the
+   original bucket-of-linked-lists over the whole vector; SORT_FLAT
+   splits the indexed range into tiles of 1<<SORT_TILE_BITS samples,
+   each a packed array of keys sorted by (value, position). */
+#define SORT_LINKED 0
+#define SORT_FLAT   1
+
+#define SORT_TILE_BITS  14  /* default; see sort_settiles() */
+
+/* Tiles are keyed by absolute sample position rather than by offset
+   in the vector, so a tile survives sort_setup() on a different
+   vector as long as the samples it covers are unchanged. */
+typedef struct sort_tile{
+  long tag;                /* absolute position>>tilebits */
+  long begin,end;          /* absolute range of samples indexed */
+  unsigned long long print; /* fingerprint of those samples */
+  long gen;                /* sort_setup() generation tile is valid for */
+  long used;               /* number of keys */
+  u_int32_t *keys;         /* value<<16 | offset within tile, ascending */
+} sort_tile;
+
 typedef struct sort_info{
   int16_t *vector;                /* vector (storage doesn't belong to us) */
 
@@ -19,25 +40,74 @@ typedef struct sort_info{
   long  maxsize;                 /* maximum vector size */
 
   long sortbegin;                /* range of contiguous sorted area */
+  long sortlo,sorthi;            /* range to index */
   long lo,hi;                    /* current post, overlap range */
-  int  val;                      /* ...and val */
+  int  val;                      /* ...and key */
+  int16_t first;                 /* ...and first sample of the key */
+  long scan,scanhi;              /* range past the last full key */
 
-  /* sort structs */
-  sort_link **head;           /* sort buckets (65536) */
+  int  mode;                     /* SORT_LINKED or SORT_FLAT */
+  int  width;                    /* samples per key */
 
+  /* sort structs */
   long *bucketusage;          /*  of used buckets (65536) */
   long lastbucket;
+
+  /* SORT_LINKED */
+  sort_link **head;           /* sort buckets (65536) */
   sort_link *revindex;
 
+  /* SORT_FLAT */
+  sort_tile *tiles;           /* ring of tiles, indexed by tag&tilemask */
+  long tilemask;
+  int  tilebits;              /* log2 of the samples per tile */
+  u_int32_t *scratch;         /* radix sort scratch (two tiles' worth) */
+  long gen;                   /* bumped by each sort_setup() */
+  long sortpos;               /* ib() when the tiles were validated */
+  long tag;                   /* tile holding the current match... */
+  u_int32_t *cursor;          /* ...the match itself... */
+  u_int32_t *cursorend;       /* ...and the end of that tile */
+
+  long tilesspanned;          /* statistics: tiles in the ranges to index, */
+  long tilesqueried;          /* ...tiles looked at by queries, */
+  long tilesbuilt;            /* ...tiles indexed, */
+  long tilesreused;           /* ...and tiles carried over unchanged */
+
 } sort_info;
 
 /*! ========================================================================
  * sort_alloc()
  *
  * Allocates and initializes a new, empty sort_info object, which can
- * be used to index up to (size) samples from a vector.
+ * be used to index up to (size) samples from a vector.  (mode) selects
+ * the index layout, SORT_LINKED or SORT_FLAT.  Both answer queries
+ * identically; SORT_FLAT uses half the memory, finds the first hit
+ * by binary search rather than by walking a list, and carries tiles
+ * whose samples are unchanged over from one sort_setup() to the next.
+ */
+extern sort_info *sort_alloc(long size,int mode);
+
+/*! ========================================================================
+ * sort_setwidth()
+ *
+ * Sets the number of consecutive samples (width) that make up each key
+ * in the index; the default is 1.  With a wider key, a hit requires the
+ * whole run of (width) samples to match rather than a single value, so
+ * quiet passages with few distinct sample values produce far fewer
+ * candidates.  Any existing index is discarded.
  */
-extern sort_info *sort_alloc(long size);
+extern void sort_setwidth(sort_info *i,int width);
+
+/*! ========================================================================
+ * sort_settiles()
+ *
+ * Sets the size of SORT_FLAT tiles to (1<<bits) samples, at most 65536;
+ * the default is SORT_TILE_BITS.  Smaller tiles cost more binary
+ * searches per query, but an index over a vector that keeps changing
+ * at one end has less to rebuild each time.  Any existing index is
+ * discarded.
+ */
+extern void sort_settiles(sort_info *i,int bits);
 
 /*! ========================================================================
  * sort_unsortall() (internal)
@@ -57,12 +127,31 @@ extern void sort_unsortall(sort_info *i);
  * will eventually be indexed for fast searching.  (sortlo, sorthi)
  * are absolute sample positions.
  *
+ * With SORT_FLAT, the previous vector's index is kept as a sliding
+ * window: tiles outside the new range are dropped, and tiles inside it
+ * are reused if the samples they cover are unchanged, so only the
+ * parts that differ are indexed again.  Tiles are only indexed once a
+ * search window reaches them, so parts of the range that are never
+ * searched are never indexed.
+ *
  * Note: size *must* be <= the size given to the preceding sort_alloc(),
  * but no error checking is done here.
  */
 extern void sort_setup(sort_info *i,int16_t *vector,long *abspos,long size,
 		       long sortlo, long sorthi);
 
+/*! ========================================================================
+ * sort_update()
+ *
+ * sort_setup(), when the samples before the absolute position (changed)
+ * are known to be the same as when the index was last set up.  With
+ * SORT_FLAT, tiles that were already checked and lie wholly before
+ * (changed) are kept without looking at their samples again, so keeping
+ * an index over a growing vector costs only what was added to it.
+ */
+extern void sort_update(sort_info *i,int16_t *vector,long *abspos,long size,
+			long sortlo,long sorthi,long changed);
+
 /* =========================================================================
  * sort_free()
  *
@@ -73,26 +162,32 @@ extern void sort_free(sort_info *i);
 /*! ========================================================================
  * sort_getmatch()
  *
- * This function returns a sort_link_t pointer which refers to the
- * first sample equal to (value) in the vector.  It only searches for
- * hits within (overlap) samples of (post), where (post) is an offset
- * within the vector.  The caller can determine the position of the
- * matched sample using ipos(sort_info *, sort_link *).
+ * This function returns the position (offset within the vector) of
+ * the first run of samples equal to those at (value) in the vector.
+ * The run is as long as the key width set by sort_setwidth(); (n) is
+ * the number of samples available at (value).  It only searches
+ * for hits within (overlap) samples of (post), where (post) is an
+ * offset within the vector.
+ *
+ * Where a full key can't be formed, either because (n) is too short
+ * or near the end of the vector, hits fall back to matching the
+ * single sample at (value).
  *
- * This function returns NULL if no matches were found.
+ * This function returns -1 if no matches were found.
  */
-extern sort_link *sort_getmatch(sort_info *i,long post,long overlap,int value);
+extern long sort_getmatch(sort_info *i,long post,long overlap,
+			  int16_t *value,long n);
 
 /*! ========================================================================
  * sort_nextmatch()
  *
- * This function returns a sort_link_t pointer which refers to the
- * next sample matching the criteria previously passed to
- * sort_getmatch().  See sort_getmatch() for details.
+ * This function returns the position of the next sample matching the
+ * criteria previously passed to sort_getmatch(), given the position
+ * (prev) it returned last.  See sort_getmatch() for details.
  *
- * This function returns NULL if no further matches were found.
+ * This function returns -1 if no further matches were found.
  */
-extern sort_link *sort_nextmatch(sort_info *i,sort_link *prev);
+extern long sort_nextmatch(sort_info *i,long prev);
 
 /* ===========================================================================
  * is()
@@ -128,7 +223,7 @@ extern sort_link *sort_nextmatch(sort_info *i,sort_link *prev);
  * ipos()
  *
  * This macro returns the relative position (offset) within the indexed vector
- * at which the given match was found.
+ * of the given sort_link (SORT_LINKED only).
  *
  * It uses a little-known and frightening aspect of C pointer arithmetic:
  * subtracting a pointer is not an arithmetic subtraction, but rather the
@@ -108,6 +108,15 @@ void offset_adjust_settings(cdrom_paranoia *p, void(*callback)(long,int)){
     long av=(p->stage2.offpoints?p->stage2.offaccum/p->stage2.offpoints:0);
     
     if(abs(av)>p->dynoverlap/4){
+
+      /* Stage 1 running ahead (see i_stage1_ahead()) works on a copy
+	 of the statistics, but can't move the cache around; it gives
+	 up, and leaves it to stage 1 proper */
+      if(p->ahead){
+	p->ahead=2;
+	return;
+      }
+
       av=(av/MIN_SECTOR_EPSILON)*MIN_SECTOR_EPSILON;
       
       if(callback)(*callback)(ce(p->root.vector),PARANOIA_CB_DRIFT);
@@ -117,16 +126,19 @@ void offset_adjust_settings(cdrom_paranoia *p, void(*callback)(long,int)){
 	 (potentially unstable) feedback loop */
       {
 	c_block *c=c_first(p);
-	v_fragment *v=v_first(p);
+	long i=0;
+
+	/* moving every fragment by the same amount keeps them in order */
+	while(i<v_count(p)){
+	  v_fragment *v=v_get(p,i);
 
-	while(v && v->one){
 	  /* safeguard beginning bounds case with a hammer */
 	  if(fb(v)<av || cb(v->one)<av){
-	    v->one=NULL;
+	    free_v_fragment(v);
 	  }else{
 	    fb(v)-=av;
+	    i++;
 	  }
-	  v=v_next(v);
 	}
 	while(c){
 	  long adj=min(av,cb(c));
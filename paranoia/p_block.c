@@ -1,7 +1,10 @@
+#define _GNU_SOURCE /* get memfd_create */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "p_block.h"
 #include "../interface/cdda_interface.h"
 #include "cdda_paranoia.h"
@@ -78,6 +81,8 @@ linked_list *copy_list(linked_list *list){
 
 /**** C_block stuff ******************************************************/
 
+static void c_ring_unmap(int16_t *ring,long words,int mirrored);
+
 static c_block *i_cblock_constructor(cdrom_paranoia *p){
   c_block *ret=calloc(1,sizeof(c_block));
   return(ret);
@@ -85,8 +90,15 @@ static c_block *i_cblock_constructor(cdrom_paranoia *p){
 
 void i_cblock_destructor(c_block *c){
   if(c){
-    if(c->vector)free(c->vector);
-    if(c->flags)free(c->flags);
+    if(c->slab){
+      c_slab_put(c->p,c->vector,c->slab);
+    }else if(c->ring){
+      c_ring_unmap(c->ring,c->ringsize,c->mirrored);
+      if(c->flags)free(c->flags);
+    }else{
+      if(c->vector)free(c->vector);
+      if(c->flags)free(c->flags);
+    }
     c->e=NULL;
     free(c);
   }
@@ -102,32 +114,40 @@ c_block *new_c_block(cdrom_paranoia *p){
 
 void free_c_block(c_block *c){
   /* also rid ourselves of v_fragments that reference this block */
-  v_fragment *v=v_first(c->p);
-  
-  while(v){
-    v_fragment *next=v_next(v);
-    if(v->one==c)free_v_fragment(v);
-    v=next;
-  }    
+  while(c->frags)
+    free_v_fragment(c->frags);
 
-  free_elem(c->e,1);
-}
-
-static v_fragment *i_vfragment_constructor(void){
-  v_fragment *ret=calloc(1,sizeof(v_fragment));
-  return(ret);
+  /* Stage 1 may still be reading ahead against this block; if so, it
+     leaves the cache now but is only freed once that's over */
+  if(c->pinned){
+    free_elem(c->e,0);
+    c->e=NULL;
+    c->pinned=2;
+  }else
+    free_elem(c->e,1);
 }
 
-static void i_v_fragment_destructor(v_fragment *v){
-  free(v);
+/* Position in the fragment list at which a fragment beginning at
+   (begin) would be inserted */
+static long v_search(v_list *l,long begin){
+  long lo=0,hi=l->active;
+  
+  while(lo<hi){
+    long mid=(lo+hi)>>1;
+    if(l->v[mid]->begin<begin)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return(lo);
 }
 
 v_fragment *new_v_fragment(cdrom_paranoia *p,c_block *one,
 			   long begin, long end, int last){
-  linked_element *e=new_elem(p->fragments);
-  v_fragment *b=e->ptr;
+  v_list *l=&p->fragments;
+  v_fragment *b=calloc(1,sizeof(v_fragment));
+  long i;
   
-  b->e=e;
   b->p=p;
 
   b->one=one;
@@ -136,11 +156,42 @@ v_fragment *new_v_fragment(cdrom_paranoia *p,c_block *one,
   b->size=end-begin;
   b->lastsector=last;
 
+  /* link into the block's own list */
+  b->next=one->frags;
+  if(one->frags)one->frags->prev=b;
+  one->frags=b;
+
+  /* and into the sorted list, ahead of any beginning at the same
+     place */
+  if(l->active>=l->alloc){
+    l->alloc=(l->alloc?l->alloc*2:64);
+    l->v=realloc(l->v,l->alloc*sizeof(*l->v));
+  }
+  i=v_search(l,begin);
+  memmove(l->v+i+1,l->v+i,(l->active-i)*sizeof(*l->v));
+  l->v[i]=b;
+  l->active++;
+
   return(b);
 }
 
 void free_v_fragment(v_fragment *v){
-  free_elem(v->e,1);
+  v_list *l=&v->p->fragments;
+  long i=v_search(l,v->begin);
+
+  while(l->v[i]!=v)i++;
+  memmove(l->v+i,l->v+i+1,(l->active-i-1)*sizeof(*l->v));
+  l->active--;
+
+  if(v->one){
+    if(v->prev)
+      v->prev->next=v->next;
+    else
+      v->one->frags=v->next;
+    if(v->next)v->next->prev=v->prev;
+  }
+
+  free(v);
 }
 
 c_block *c_first(cdrom_paranoia *p){
@@ -168,28 +219,19 @@ c_block *c_prev(c_block *c){
 }
 
 v_fragment *v_first(cdrom_paranoia *p){
-  if(p->fragments->head){
-    return(p->fragments->head->ptr);
-  }
+  if(p->fragments.active)
+    return(p->fragments.v[0]);
   return(NULL);
 }
 
-v_fragment *v_last(cdrom_paranoia *p){
-  if(p->fragments->tail)
-    return(p->fragments->tail->ptr);
+v_fragment *v_get(cdrom_paranoia *p,long i){
+  if(i<p->fragments.active)
+    return(p->fragments.v[i]);
   return(NULL);
 }
 
-v_fragment *v_next(v_fragment *v){
-  if(v->e->next)
-    return(v->e->next->ptr);
-  return(NULL);
-}
-
-v_fragment *v_prev(v_fragment *v){
-  if(v->e->prev)
-    return(v->e->prev->ptr);
-  return(NULL);
+long v_count(cdrom_paranoia *p){
+  return(p->fragments.active);
 }
 
 void recover_cache(cdrom_paranoia *p){
@@ -202,6 +244,76 @@ void recover_cache(cdrom_paranoia *p){
 
 }
 
+/**** C_block slab pool ************************************************/
+
+/* Every read allocates a vector and flags for a whole cache model's
+ * worth of sectors, and every c_block culled by recover_cache() frees
+ * them again, megabytes at a time.  Instead, both live in one slab of
+ * the pool, which c_blocks borrow and give back.  In steady state the
+ * pool holds as many slabs as the cache holds c_blocks, and reading
+ * allocates nothing.
+ *
+ * All slabs are the same size, set by the cache model; if that
+ * changes, slabs of the old size are freed as they come back.
+ */
+
+int16_t *c_slab_get(cdrom_paranoia *p,unsigned char **flags){
+  c_pool *pool=&p->pool;
+  long words=p->cdcache_size*CD_FRAMEWORDS;
+  void *slab;
+
+  if(pool->words!=words){
+    long page=sysconf(_SC_PAGESIZE);
+    c_slab_free(p);
+    pool->words=words;
+
+    /* the vector is rounded up to whole pages, so both it and the
+       flags start on a page boundary */
+    pool->flagoff=(words*sizeof(int16_t)+page-1)/page*page;
+  }
+
+  if(pool->free){
+    slab=pool->free;
+    pool->free=*(void **)slab;
+    pool->freecount--;
+  }else{
+    if(posix_memalign(&slab,sysconf(_SC_PAGESIZE),pool->flagoff+words))
+      return(NULL);
+    pool->allocs++;
+  }
+
+  pool->borrows++;
+  if(flags)*flags=(unsigned char *)slab+pool->flagoff;
+  return(slab);
+}
+
+void c_slab_put(cdrom_paranoia *p,void *slab,long words){
+  c_pool *pool=&p->pool;
+
+  /* keep no more than the cache could use at once */
+  if(words!=pool->words || pool->freecount>p->cache_limit){
+    free(slab);
+    pool->releases++;
+    return;
+  }
+
+  *(void **)slab=pool->free;
+  pool->free=slab;
+  pool->freecount++;
+}
+
+void c_slab_free(cdrom_paranoia *p){
+  c_pool *pool=&p->pool;
+
+  while(pool->free){
+    void *next=*(void **)pool->free;
+    free(pool->free);
+    pool->free=next;
+    pool->releases++;
+  }
+  pool->freecount=0;
+}
+
 int16_t *v_buffer(v_fragment *v){
   if(!v->one)return(NULL);
   if(!cv(v->one))return(NULL);
@@ -214,10 +326,146 @@ c_block *c_alloc(int16_t *vector,long begin,long size){
   c->vector=vector;
   c->begin=begin;
   c->size=size;
+  c->changed=begin;
+  return(c);
+}
+
+/**** Root ring ********************************************************/
+
+/* The root grows at the end with every verified read and is trimmed at
+ * the front by i_paranoia_trim() as the cursor advances.  Held in a
+ * plain allocation, each append is a realloc() and each trim a
+ * memmove() of everything that remains.  A ring block instead keeps
+ * its vector in a buffer with room to spare: trimming just moves the
+ * start of the vector forward, and appending copies only the new data
+ * in behind the end.
+ *
+ * The vector still has to be contiguous, as everything from the rift
+ * analysis to paranoia_read_limited() indexes it directly.  Where we
+ * can, the ring is mapped twice, back to back, so that a vector that
+ * wraps past the end of the ring simply carries on through the second
+ * mapping.  Where we can't, the ring is an ordinary buffer twice the
+ * size of the data it holds, and the vector is moved back to the start
+ * only when it runs into the end; by then at least as much has been
+ * trimmed from the front as is left to move.
+ */
+
+#define C_RING_MIN (CD_FRAMEWORDS*MAX_SECTOR_OVERLAP*4)
+
+static void c_ring_unmap(int16_t *ring,long words,int mirrored){
+  if(mirrored)
+    munmap(ring,words*2*sizeof(int16_t));
+  else
+    free(ring);
+}
+
+/* Map (bytes), a multiple of the page size, twice in a row.  Returns
+   NULL if that can't be done here. */
+static int16_t *c_ring_map(long bytes){
+#ifdef MFD_CLOEXEC
+  int fd=memfd_create("paranoia root",MFD_CLOEXEC);
+  char *base;
+
+  if(fd<0)return(NULL);
+  if(ftruncate(fd,bytes)){
+    close(fd);
+    return(NULL);
+  }
+
+  /* reserve the whole span first, so nothing else lands in between */
+  base=mmap(NULL,bytes*2,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(base==MAP_FAILED){
+    close(fd);
+    return(NULL);
+  }
+
+  if(mmap(base,bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,
+	  fd,0)==MAP_FAILED ||
+     mmap(base+bytes,bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,
+	  fd,0)==MAP_FAILED){
+    munmap(base,bytes*2);
+    close(fd);
+    return(NULL);
+  }
+
+  close(fd);
+  return((int16_t *)base);
+#else
+  return(NULL);
+#endif
+}
+
+/* Move the vector into a new ring with room for at least (words). */
+static void c_ring_grow(c_block *v,long words){
+  long page=sysconf(_SC_PAGESIZE);
+  long bytes=words*2*sizeof(int16_t);
+  int16_t *ring;
+  int mirrored;
+
+  if(bytes<(long)(C_RING_MIN*sizeof(int16_t)))
+    bytes=C_RING_MIN*sizeof(int16_t);
+  bytes=(bytes+page-1)/page*page;
+
+  ring=c_ring_map(bytes);
+  mirrored=(ring!=NULL);
+  if(!mirrored)
+    /* no mirror; the buffer is sized to hold twice what's asked for */
+    ring=malloc(bytes);
+
+  if(v->size)memcpy(ring,v->vector,v->size*sizeof(int16_t));
+  if(v->ring)c_ring_unmap(v->ring,v->ringsize,v->mirrored);
+
+  v->ringsize=bytes/sizeof(int16_t);
+  v->mirrored=mirrored;
+  v->ring=ring;
+  v->vector=ring;
+}
+
+/* Make room for the vector to grow to (words) samples in place. */
+static void c_ring_reserve(c_block *v,long words){
+  if(v->mirrored){
+    if(words<=v->ringsize)return;
+  }else{
+    if(v->vector-v->ring+words<=v->ringsize)return;
+    if(words<=v->ringsize/2){
+      memmove(v->ring,v->vector,v->size*sizeof(int16_t));
+      v->vector=v->ring;
+      return;
+    }
+  }
+  c_ring_grow(v,words);
+}
+
+/* A c_block still in its pool slab (the root, when it was promoted
+   straight from a read) can't grow where it is; move it into a ring,
+   with room for (words), and give the slab back. */
+static void c_unslab(c_block *v,long words){
+  int16_t *slab=v->vector;
+
+  if(v->flags){
+    unsigned char *flags=malloc(v->size);
+    memcpy(flags,v->flags,v->size);
+    v->flags=flags;
+  }
+  c_ring_grow(v,words);
+  c_slab_put(v->p,slab,v->slab);
+  v->slab=0;
+}
+
+/* alloc a ring c_block not on a cache list; (vector) is copied, and
+   remains the caller's */
+c_block *c_ring_alloc(int16_t *vector,long begin,long size){
+  c_block *c=calloc(1,sizeof(c_block));
+  c_ring_grow(c,size);
+  memcpy(c->vector,vector,size*sizeof(int16_t));
+  c->begin=begin;
+  c->size=size;
+  c->changed=begin;
   return(c);
 }
 
 void c_set(c_block *v,long begin){
+  v->changed=min(v->changed,min(v->begin,begin));
   v->begin=begin;
 }
 
@@ -226,7 +474,11 @@ void c_insert(c_block *v,long pos,int16_t *b,long size){
   int vs=cs(v);
   if(pos<0 || pos>vs)return;
 
-  if(v->vector)
+  if(v->slab)
+    c_unslab(v,size+vs);
+  if(v->ring)
+    c_ring_reserve(v,size+vs);
+  else if(v->vector)
     v->vector=realloc(v->vector,sizeof(int16_t)*(size+vs));
   else
     v->vector=malloc(sizeof(int16_t)*size);
@@ -236,6 +488,7 @@ void c_insert(c_block *v,long pos,int16_t *b,long size){
   memcpy(v->vector+pos,b,size*sizeof(int16_t));
 
   v->size+=size;
+  v->changed=min(v->changed,v->begin+pos);
 }
 
 void c_remove(c_block *v,long cutpos,long cutsize){
@@ -249,6 +502,7 @@ void c_remove(c_block *v,long cutpos,long cutsize){
             (vs-cutpos-cutsize)*sizeof(int16_t));
   
   v->size-=cutsize;
+  v->changed=min(v->changed,v->begin+cutpos);
 }
 
 void c_overwrite(c_block *v,long pos,int16_t *b,long size){
@@ -258,23 +512,42 @@ void c_overwrite(c_block *v,long pos,int16_t *b,long size){
   if(pos+size>vs)size=vs-pos;
 
   memcpy(v->vector+pos,b,size*sizeof(int16_t));
+  v->changed=min(v->changed,v->begin+pos);
 }
 
 void c_append(c_block *v, int16_t *vector, long size){
   int vs=cs(v);
 
   /* update the vector */
-  if(v->vector)
+  if(v->slab)
+    c_unslab(v,size+vs);
+  if(v->ring)
+    c_ring_reserve(v,size+vs);
+  else if(v->vector)
     v->vector=realloc(v->vector,sizeof(int16_t)*(size+vs));
   else
     v->vector=malloc(sizeof(int16_t)*size);
   memcpy(v->vector+vs,vector,sizeof(int16_t)*size);
 
   v->size+=size;
+  v->changed=min(v->changed,v->begin+vs);
 }
 
 void c_removef(c_block *v, long cut){
-  c_remove(v,0,cut);
+  if(v->ring){
+    /* no need to move anything; the vector just starts later */
+    long vs=cs(v);
+    long n=cut;
+    if(n<0 || n>vs)n=vs;
+
+    v->vector+=n;
+    v->size-=n;
+    if(v->size==0)
+      v->vector=v->ring;
+    else if(v->mirrored && v->vector>=v->ring+v->ringsize)
+      v->vector-=v->ringsize;
+  }else
+    c_remove(v,0,cut);
   v->begin+=cut;
 }
 
@@ -316,13 +589,14 @@ cdrom_paranoia *paranoia_init(cdrom_drive *d){
   p->cache=new_list((void *)&i_cblock_constructor,
 		    (void *)&i_cblock_destructor);
 
-  p->fragments=new_list((void *)&i_vfragment_constructor,
-			(void *)&i_v_fragment_destructor);
-
   p->cdcache_begin= 9999999;
   p->cdcache_end= 9999999;
   p->cdcache_size=CACHEMODEL_SECTORS;
-  p->sortcache=sort_alloc(p->cdcache_size*CD_FRAMEWORDS);
+  p->sortcache=sort_alloc(p->cdcache_size*CD_FRAMEWORDS,SORT_FLAT);
+  sort_setwidth(p->sortcache,MIN_WORDS_KEY);
+  p->rootsort=sort_alloc(2*MAX_SECTOR_OVERLAP*CD_FRAMEWORDS,SORT_FLAT);
+  sort_setwidth(p->rootsort,MIN_WORDS_KEY);
+  sort_settiles(p->rootsort,ROOT_TILE_BITS);
   p->d=d;
   p->dynoverlap=MAX_SECTOR_OVERLAP*CD_FRAMEWORDS;
   p->cache_limit=JIGGLE_MODULO;
@@ -342,3 +616,25 @@ int paranoia_cachemodel_size(cdrom_paranoia *p,int sectors){
     p->cdcache_size=sectors;
   return ret;
 }
+
+static void i_sort_statistics(sort_info *i,paranoia_stats *s){
+  s->tiles_spanned+=i->tilesspanned;
+  s->tiles_queried+=i->tilesqueried;
+  s->tiles_built+=i->tilesbuilt;
+  s->tiles_reused+=i->tilesreused;
+}
+
+/* Fills in (s) with the counts since paranoia_init().  Once the cache
+   is full, reads borrow the slabs culled blocks gave back, so
+   slab_allocs should stop growing while slab_borrows goes on.  The
+   tile counts are those of the indexes searched on the calling
+   thread; stage 1 on other threads (see paranoia_threads() and
+   paranoia_readahead()) uses indexes of its own. */
+void paranoia_statistics(cdrom_paranoia *p,paranoia_stats *s){
+  memset(s,0,sizeof(*s));
+  s->slab_allocs=p->pool.allocs;
+  s->slab_releases=p->pool.releases;
+  s->slab_borrows=p->pool.borrows;
+  i_sort_statistics(p->sortcache,s);
+  i_sort_statistics(p->rootsort,s);
+}
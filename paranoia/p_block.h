@@ -11,6 +11,8 @@
 #define MIN_WORDS_OVERLAP    64     /* 16 bit words */
 #define MIN_WORDS_SEARCH     64     /* 16 bit words */
 #define MIN_WORDS_RIFT       16     /* 16 bit words */
+#define MIN_WORDS_KEY         4     /* 16 bit words */
+#define ROOT_TILE_BITS       10     /* log2 16 bit words */
 #define MAX_SECTOR_OVERLAP   32     /* sectors */
 #define MIN_SECTOR_EPSILON  128     /* words */
 #define MIN_SECTOR_BACKUP    16     /* sectors */
@@ -75,6 +77,21 @@ typedef struct c_block{
   struct cdrom_paranoia *p;
   struct linked_element *e;
 
+  long slab; /* samples in the pool slab holding vector and flags, or 0
+		if they were allocated on their own */
+
+  struct v_fragment *frags; /* the verified fragments of this block */
+  int pinned; /* 1 while stage 1 reads ahead against this block; 2 if it
+		was freed meanwhile, and is only waiting for that to end */
+
+  int16_t *ring; /* if set, vector lives in this ring rather than its
+		    own allocation; see c_ring_alloc() */
+  long ringsize; /* samples in the ring */
+  int mirrored;  /* the ring is mapped twice, back to back */
+
+  long changed; /* absolute position of the first sample altered since
+		   this was last reset to ce(); see i_stage2_index() */
+
 } c_block;
 
 extern void free_c_block(c_block *c);
@@ -91,12 +108,23 @@ typedef struct v_fragment{
   /* end of session cases */
   long lastsector;
 
-  /* linked list */
   struct cdrom_paranoia *p;
-  struct linked_element *e;
+
+  /* the other fragments of the same block (one) */
+  struct v_fragment *prev;
+  struct v_fragment *next;
 
 } v_fragment;
 
+/* All verified fragments, kept in order of beginning sample position
+   (fragments beginning at the same position, newest first), so that
+   stage 2 can take them as they come. */
+typedef struct v_list{
+  v_fragment **v;
+  long active;
+  long alloc;
+} v_list;
+
 extern void free_v_fragment(v_fragment *c);
 extern v_fragment *new_v_fragment(struct cdrom_paranoia *p,c_block *one,
 				  long begin, long end, int lastsector);
@@ -108,9 +136,8 @@ extern c_block *c_next(c_block *c);
 extern c_block *c_prev(c_block *c);
 
 extern v_fragment *v_first(struct cdrom_paranoia *p);
-extern v_fragment *v_last(struct cdrom_paranoia *p);
-extern v_fragment *v_next(v_fragment *v);
-extern v_fragment *v_prev(v_fragment *v);
+extern v_fragment *v_get(struct cdrom_paranoia *p,long i);
+extern long v_count(struct cdrom_paranoia *p);
 
 typedef struct root_block{
   long returnedlimit;   
@@ -133,14 +160,52 @@ typedef struct offsets{
 
 } offsets;
 
+/* Freed c_block vectors and flags are kept here for the next read
+   rather than going back to the system; see c_slab_get(). */
+typedef struct c_pool{
+  void *free;      /* free slabs, linked through their first word */
+  long freecount;
+  long words;      /* samples per slab */
+  long flagoff;    /* byte offset of the flags within a slab */
+
+  long allocs;     /* statistics: slabs obtained from the system, */
+  long releases;   /* ...slabs given back to it, */
+  long borrows;    /* ...and slabs handed out to c_blocks */
+} c_pool;
+
+typedef struct c_readsize{
+  int enabled;
+  long size;       /* sectors per low-level read now */
+  long max;        /* d->nsectors when we started; see i_readsize_update() */
+  long base;       /* the size (size) is being measured against... */
+  long baserate;   /* ...and its throughput, in sectors per second */
+  int dir;         /* the way the next probe goes (+1 or -1) */
+  int probing;     /* (size) is a probe away from (base) */
+  int recovering;  /* growing back after a back-off */
+  int wait;        /* spans to let go by before measuring again */
+  long spans;      /* measured so far at (size) */
+  long sectors;
+  long usec;
+} c_readsize;
+
 typedef struct cdrom_paranoia{
   cdrom_drive *d;
 
   root_block root;        /* verified/reconstructed cached data */
   linked_list *cache;     /* our data as read from the cdrom */
   long cache_limit;
-  linked_list *fragments; /* fragments of blocks that have been 'verified' */
+  v_list fragments;       /* fragments of blocks that have been 'verified' */
   sort_info *sortcache;
+  sort_info *rootsort;    /* index of the root for stage 2; see i_stage2() */
+  c_pool pool;            /* recycled c_block vectors and flags */
+  c_readsize readsize;    /* see i_readsize_update() */
+  struct c_readahead *readahead; /* the next read, if reading ahead */
+  int ahead;              /* set in the copy of this struct that stage 1
+			     reads ahead with; 2 once it has given up */
+  struct c_stage1pool *stage1pool; /* workers for stage 1, if it runs
+				      in parallel */
+  struct c_stage1worker *stage1work; /* set in the copy of this struct
+					each worker runs with */
 
   /* cache tracking */
   int cdcache_size;
@@ -165,6 +230,7 @@ typedef struct cdrom_paranoia{
 } cdrom_paranoia;
 
 extern c_block *c_alloc(int16_t *vector,long begin,long size);
+extern c_block *c_ring_alloc(int16_t *vector,long begin,long size);
 extern void c_set(c_block *v,long begin);
 extern void c_insert(c_block *v,long pos,int16_t *b,long size);
 extern void c_remove(c_block *v,long cutpos,long cutsize);
@@ -179,6 +245,9 @@ extern void c_removef(c_block *v, long cut);
 /* pos here is vector position from zero */
 
 extern void recover_cache(cdrom_paranoia *p);
+extern int16_t *c_slab_get(cdrom_paranoia *p,unsigned char **flags);
+extern void c_slab_put(cdrom_paranoia *p,void *slab,long words);
+extern void c_slab_free(cdrom_paranoia *p);
 extern void i_paranoia_firstlast(cdrom_paranoia *p);
 
 #define cv(c) (c->vector)
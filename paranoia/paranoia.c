@@ -74,11 +74,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
 #include "../interface/cdda_interface.h"
 #include "../interface/smallft.h"
 #include "../version.h"
 #include "p_block.h"
 #include "cdda_paranoia.h"
+#include "runs.h"
 #include "overlap.h"
 #include "gap.h"
 #include "isort.h"
@@ -151,16 +154,24 @@ static inline long i_paranoia_overlap(int16_t *buffA,int16_t *buffB,
 			       long *ret_begin, long *ret_end){
   long beginA=offsetA,endA=offsetA;
   long beginB=offsetB,endB=offsetB;
+  long run;
 
-  /* Scan backward to extend the matching run in that direction. */
-  for(;beginA>=0 && beginB>=0;beginA--,beginB--)
-    if(buffA[beginA]!=buffB[beginB])break;
-  beginA++;
-  beginB++;
+  /* Scan backward to extend the matching run in that direction.  See
+   * runs.c; this is the vectorized equivalent of
+   *
+   *   for(;beginA>=0 && beginB>=0;beginA--,beginB--)
+   *     if(buffA[beginA]!=buffB[beginB])break;
+   *   beginA++;
+   *   beginB++;
+   */
+  run=i_run_r(buffA+beginA,buffB+beginB,min(beginA,beginB)+1);
+  beginA-=run-1;
+  beginB-=run-1;
   
   /* Scan forward to extend the matching run in that direction. */
-  for(;endA<sizeA && endB<sizeB;endA++,endB++)
-    if(buffA[endA]!=buffB[endB])break;
+  run=i_run_f(buffA+endA,buffB+endB,min(sizeA-endA,sizeB-endB));
+  endA+=run;
+  endB+=run;
   
   /* Return the result of our search. */
   if(ret_begin)*ret_begin=beginA;
@@ -196,6 +207,17 @@ static inline long i_paranoia_overlap2(int16_t *buffA,int16_t *buffB,
   
   /* Scan backward to extend the matching run in that direction. */
   for(;beginA>=0 && beginB>=0;beginA--,beginB--){
+
+    /* Skip straight to the next sample that could end the run, i.e.
+     * one that doesn't match or has flags that need looking at.
+     */
+    long run=i_run_flags_r(buffA+beginA,buffB+beginB,
+			   flagsA+beginA,flagsB+beginB,
+			   min(beginA,beginB)+1,FLAGS_EDGE,FLAGS_UNREAD);
+    beginA-=run;
+    beginB-=run;
+    if(beginA<0 || beginB<0)break;
+
     if(buffA[beginA]!=buffB[beginB])break;
 
     /* don't allow matching across matching sector boundaries. The
@@ -219,6 +241,13 @@ static inline long i_paranoia_overlap2(int16_t *buffA,int16_t *buffB,
   
   /* Scan forward to extend the matching run in that direction. */
   for(;endA<sizeA && endB<sizeB;endA++,endB++){
+    long run=i_run_flags_f(buffA+endA,buffB+endB,
+			   flagsA+endA,flagsB+endB,
+			   min(sizeA-endA,sizeB-endB),FLAGS_EDGE,FLAGS_UNREAD);
+    endA+=run;
+    endB+=run;
+    if(endA>=sizeA || endB>=sizeB)break;
+
     if(buffA[endA]!=buffB[endB])break;
 
     /* don't allow matching across matching sector boundaries */
@@ -329,7 +358,7 @@ static inline long try_sort_sync(cdrom_paranoia *p,
 				 long *offset,void (*callback)(long,int)){
   
   long dynoverlap=p->dynoverlap;
-  sort_link *ptr=NULL;
+  long match;
   unsigned char *Bflags=B->flags;
 
   /* block flag matches FLAGS_UNREAD (and hence unmatchable) */
@@ -369,18 +398,22 @@ static inline long try_sort_sync(cdrom_paranoia *p,
    * either a bad sample, or the two c_blocks are jittered with respect
    * to each other.  Now we search through A for samples that do have
    * the same value as B's post.  The search looks from first to last
-   * occurrence witin (dynoverlap) samples of (post).
+   * occurrence witin (dynoverlap) samples of (post).  If the index is
+   * keyed on runs of samples (MIN_WORDS_KEY), only positions where the
+   * whole run after (post) matches are returned, which spares
+   * do_const_sync() the coincidental hits on a single value.
    */
-  ptr=sort_getmatch(A,post-ib(A),dynoverlap,cv(B)[post-cb(B)]);
+  match=sort_getmatch(A,post-ib(A),dynoverlap,
+		     cv(B)+(post-cb(B)),ce(B)-post);
   
-  while(ptr){
+  while(match>=0){
     
     /* We've found a matching sample, so try to grow the matching run in
      * both directions.  If we find a long enough run (longer than
      * MIN_WORDS_SEARCH), we've found a match.
      */
     if(do_const_sync(B,A,Aflags,
-		     post-cb(B),ipos(A,ptr),
+		     post-cb(B),match,
 		     begin,end,offset)){
 
       offset_add_value(p,&(p->stage1),*offset,callback);
@@ -391,7 +424,7 @@ static inline long try_sort_sync(cdrom_paranoia *p,
      * samples that matched to consider a matching run.  So now we check
      * for the next occurrence of that value in A.
      */
-    ptr=sort_nextmatch(A,ptr);
+    match=sort_nextmatch(A,match);
   }
   
   /* We didn't find any matches. */
@@ -416,6 +449,15 @@ afterward. */
 
 #define OVERLAP_ADJ (MIN_WORDS_OVERLAP/2-1)
 
+/* see the parallel stage 1 and read-ahead sections below */
+static void i_stage1_work_matched(cdrom_paranoia *p,c_block *old,
+				  long matchbegin,long matchend,
+				  long matchoffset);
+static void i_stage1_ahead_mark(cdrom_paranoia *p,c_block *old,
+				long begin,long end);
+static int i_stage1_ahead_adopt(cdrom_paranoia *p,c_block *new,
+				void(*callback)(long,int));
+
 
 /* ===========================================================================
  * stage1_matched() (internal)
@@ -436,7 +478,8 @@ afterward. */
  * into the verified root (and its absolute position determined) in
  * stage 2.
  */
-static inline void stage1_matched(c_block *old,c_block *new,
+static inline void stage1_matched(cdrom_paranoia *p,
+				  c_block *old,c_block *new,
 				 long matchbegin,long matchend,
 				 long matchoffset,void (*callback)(long,int)){
   long i;
@@ -534,12 +577,38 @@ static inline void stage1_matched(c_block *old,c_block *new,
 
   oldadjbegin+=OVERLAP_ADJ;
   oldadjend-=OVERLAP_ADJ;
-  for(i=oldadjbegin;i<oldadjend;i++)
-    old->flags[i]|=FLAGS_VERIFIED; /* mark verified */
+  if(p->stage1work)
+    /* one of several comparisons running in parallel; just note it */
+    i_stage1_work_matched(p,old,matchbegin,matchend,matchoffset);
+  else if(p->ahead)
+    /* running ahead; the old block isn't ours to mark yet */
+    i_stage1_ahead_mark(p,old,oldadjbegin,oldadjend);
+  else
+    for(i=oldadjbegin;i<oldadjend;i++)
+      old->flags[i]|=FLAGS_VERIFIED; /* mark verified */
     
 }
 
 
+/* ===========================================================================
+ * stage1_matched_run() (internal)
+ *
+ * stage1_matched(), for a run found by i_iterate_stage1().
+ */
+static void stage1_matched_run(cdrom_paranoia *p,c_block *old,c_block *new,
+			       long matchbegin,long matchend,
+			       long matchoffset,void (*callback)(long,int)){
+  /* purely cosmetic: if we're matching zeros, don't use the
+     callback because they will appear to be all skewed */
+  long j=matchbegin-cb(old);
+  long end=matchend-cb(old);
+  for(;j<end;j++)if(cv(old)[j]!=0)break;
+
+  stage1_matched(p,old,new,matchbegin,matchend,matchoffset,
+		 j<end?callback:NULL);
+}
+
+
 /* ===========================================================================
  * i_iterate_stage1 (internal)
  *
@@ -591,6 +660,26 @@ static long i_iterate_stage1(cdrom_paranoia *p,c_block *old,c_block *new,
   long tried=0,matched=0;
 
   if(searchsize<=0)return(0);
+
+  /* Fast path: on a good drive, the two reads usually agree at offset
+   * zero across the whole overlap.  The search below would then post
+   * once at (searchbegin), find a match at offset zero right away, and
+   * grow it over everything, stopping only where the reads were cut
+   * off at the same place or at unread samples.  If one vectorized
+   * pass finds nothing that would stop it, record that match now,
+   * just as the search would have, and skip the sync machinery.
+   */
+  if(searchsize>MIN_WORDS_SEARCH &&
+     (new->flags[searchbegin-cb(new)]&FLAGS_VERIFIED)==0 &&
+     i_run_flags_f(cv(old)+(searchbegin-cb(old)),
+		   cv(new)+(searchbegin-cb(new)),
+		   old->flags+(searchbegin-cb(old)),
+		   new->flags+(searchbegin-cb(new)),
+		   searchsize,FLAGS_EDGE,FLAGS_UNREAD)==searchsize){
+    offset_add_value(p,&(p->stage1),0,callback);
+    stage1_matched_run(p,old,new,searchbegin,searchend,0,callback);
+    return(1);
+  }
   
   /* match return values are in terms of the new vector, not old */
   /* "???: Why 23?" Odd, prime number --Monty  */
@@ -618,23 +707,12 @@ static long i_iterate_stage1(cdrom_paranoia *p,c_block *old,c_block *new,
 	
 	matched+=matchend-matchbegin;
 
-	/* purely cosmetic: if we're matching zeros, don't use the
-           callback because they will appear to be all skewed */
-	{
-	  long j=matchbegin-cb(old);
-	  long end=matchend-cb(old);
-	  for(;j<end;j++)if(cv(old)[j]!=0)break;
-
-	  /* Mark the matched samples in both c_blocks as verified.
-	   * In reality, not all the samples are marked.  See
-	   * stage1_matched() for details.
-	   */
-	  if(j<end){
-	    stage1_matched(old,new,matchbegin,matchend,matchoffset,callback);
-	  }else{
-	    stage1_matched(old,new,matchbegin,matchend,matchoffset,NULL);
-	  }
-	}
+	/* Mark the matched samples in both c_blocks as verified.
+	 * In reality, not all the samples are marked.  See
+	 * stage1_matched() for details.
+	 */
+	stage1_matched_run(p,old,new,matchbegin,matchend,matchoffset,
+			   callback);
 	ret++;
 
 	/* Skip past this verified run to look for more matches. */
@@ -652,6 +730,215 @@ static long i_iterate_stage1(cdrom_paranoia *p,c_block *old,c_block *new,
 }
 
 
+/**** Parallel stage 1 ***************************************************/
+
+/* With more than one thread to run on (see paranoia_threads()), the new
+ * c_block is compared against each old c_block independently, by a
+ * pool of workers with a sort cache each.  Rather than skip samples
+ * that an older c_block already verified, each comparison starts from
+ * the new c_block's flags as read and keeps its own marks to itself,
+ * and the jitter statistics hold still while they run.  Each one only
+ * notes the matches it finds; these are then taken up one old c_block
+ * at a time, oldest first, much as serial stage 1 would have found
+ * them: statistics, callbacks and verified marks in both c_blocks.
+ *
+ * The result doesn't depend on the number of threads, or on how the
+ * work happened to be shared out between them.  It does differ from
+ * that of the serial stage 1, which doesn't look again where an older
+ * c_block already matched, and which narrows or widens its search as
+ * the statistics change.
+ */
+
+typedef struct c_stage1match{
+  long begin;          /* the matched run, from cb(old) */
+  long end;
+  long offset;
+  int silent;          /* all zeros; reported without callbacks */
+} c_stage1match;
+
+typedef struct c_stage1found{
+  c_stage1match *m;
+  long count;
+  long alloc;
+} c_stage1found;
+
+typedef struct c_stage1worker{
+  cdrom_paranoia shadow; /* first, so that stage1_matched() finds the rest */
+  struct c_stage1pool *pool;
+  pthread_t thread;
+  c_block new;           /* the new c_block, but with flags of our own */
+  unsigned char *flags;
+  long flagsalloc;
+  c_stage1found *found;  /* for the old c_block at hand */
+} c_stage1worker;
+
+typedef struct c_stage1pool{
+  int threads;
+  c_stage1worker *w;     /* w[0] runs on the calling thread */
+  pthread_mutex_t lock;
+  long next;             /* the next old c_block to take on */
+
+  c_block **old;         /* the comparisons at hand, oldest first */
+  long oldcount;
+  long oldalloc;
+  c_block *new;
+  c_stage1found *found;  /* ...and what each one found */
+  long foundalloc;
+} c_stage1pool;
+
+/* called from stage1_matched() on a worker */
+static void i_stage1_work_matched(cdrom_paranoia *p,c_block *old,
+				  long matchbegin,long matchend,
+				  long matchoffset){
+  c_stage1found *f=((c_stage1worker *)p)->found;
+  c_stage1match *m;
+  long j;
+
+  if(f->count>=f->alloc){
+    f->alloc=(f->alloc?f->alloc*2:64);
+    f->m=realloc(f->m,f->alloc*sizeof(*f->m));
+  }
+  m=f->m+f->count++;
+  m->begin=matchbegin-cb(old);
+  m->end=matchend-cb(old);
+  m->offset=matchoffset;
+
+  /* as i_iterate_stage1() would decide */
+  for(j=m->begin;j<m->end;j++)if(cv(old)[j]!=0)break;
+  m->silent=(j>=m->end);
+}
+
+static void *i_stage1_worker(void *arg){
+  c_stage1worker *w=arg;
+  c_stage1pool *pool=w->pool;
+  c_block *new=pool->new;
+
+  w->new=*new;
+  w->new.flags=w->flags;
+  sort_setup(w->shadow.sortcache,cv(new),&cb(new),cs(new),cb(new),ce(new));
+
+  while(1){
+    long k;
+
+    pthread_mutex_lock(&pool->lock);
+    k=pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if(k>=pool->oldcount)break;
+
+    memcpy(w->flags,new->flags,cs(new));
+    w->found=pool->found+k;
+    w->found->count=0;
+    i_iterate_stage1(&w->shadow,pool->old[k],&w->new,NULL);
+  }
+  return(NULL);
+}
+
+/* Room for (n) old c_blocks to compare against; the caller fills it
+   in, oldest first, for i_stage1_parallel() */
+static c_block **i_stage1_olds(c_stage1pool *pool,long n){
+  if(n>pool->oldalloc){
+    pool->oldalloc=n;
+    pool->old=realloc(pool->old,n*sizeof(*pool->old));
+  }
+  return(pool->old);
+}
+
+static void i_stage1_parallel(cdrom_paranoia *p,long n,c_block *new,
+			      void(*callback)(long,int)){
+  c_stage1pool *pool=p->stage1pool;
+  c_block **old=pool->old;
+  long i,k,started;
+
+  if(n>pool->foundalloc){
+    pool->found=realloc(pool->found,n*sizeof(*pool->found));
+    memset(pool->found+pool->foundalloc,0,
+	   (n-pool->foundalloc)*sizeof(*pool->found));
+    pool->foundalloc=n;
+  }
+  pool->oldcount=n;
+  pool->new=new;
+  pool->next=0;
+
+  for(i=0;i<pool->threads;i++){
+    c_stage1worker *w=pool->w+i;
+    sort_info *sortcache=w->shadow.sortcache;
+
+    if(sortcache && sortcache->maxsize!=p->sortcache->maxsize){
+      sort_free(sortcache);
+      sortcache=NULL;
+    }
+    if(sortcache==NULL){
+      sortcache=sort_alloc(p->sortcache->maxsize,SORT_FLAT);
+      sort_setwidth(sortcache,MIN_WORDS_KEY);
+    }
+    if(cs(new)>w->flagsalloc){
+      w->flagsalloc=cs(new);
+      w->flags=realloc(w->flags,w->flagsalloc);
+    }
+
+    w->shadow=*p;
+    w->shadow.sortcache=sortcache;
+    w->shadow.stage1.offpoints=-1; /* hold the statistics still */
+    w->shadow.stage1pool=NULL;
+    w->shadow.stage1work=w;
+    w->shadow.readahead=NULL;
+    w->shadow.ahead=0;
+    w->pool=pool;
+  }
+
+  for(started=1;started<pool->threads && started<n;started++)
+    if(pthread_create(&pool->w[started].thread,NULL,i_stage1_worker,
+		      pool->w+started))break;
+  i_stage1_worker(pool->w);
+  for(i=1;i<started;i++)
+    pthread_join(pool->w[i].thread,NULL);
+
+  /* Take up the matches in order.  (Stage 1 running ahead stops when
+     it gives up, as it does serially.) */
+  for(k=0;k<n && p->ahead!=2;k++){
+    c_stage1found *f=pool->found+k;
+
+    if(callback)(*callback)(cb(new),PARANOIA_CB_VERIFY);
+    for(i=0;i<f->count;i++){
+      c_stage1match *m=f->m+i;
+      long begin=cb(old[k])+m->begin;
+      long end=cb(old[k])+m->end;
+
+      /* drift compensation near the start of the disc may have moved
+	 the c_blocks by different amounts since */
+      if(begin-m->offset<cb(new) || end-m->offset>ce(new))continue;
+
+      offset_add_value(p,&(p->stage1),m->offset,callback);
+      stage1_matched(p,old[k],new,begin,end,m->offset,
+		     m->silent?NULL:callback);
+    }
+  }
+}
+
+static c_stage1pool *i_stage1_pool_new(int threads){
+  c_stage1pool *pool=calloc(1,sizeof(*pool));
+  pool->threads=threads;
+  pool->w=calloc(threads,sizeof(*pool->w));
+  pthread_mutex_init(&pool->lock,NULL);
+  return(pool);
+}
+
+static void i_stage1_pool_free(c_stage1pool *pool){
+  long i;
+  for(i=0;i<pool->threads;i++){
+    c_stage1worker *w=pool->w+i;
+    if(w->shadow.sortcache)sort_free(w->shadow.sortcache);
+    if(w->flags)free(w->flags);
+  }
+  for(i=0;i<pool->foundalloc;i++)
+    if(pool->found[i].m)free(pool->found[i].m);
+  if(pool->found)free(pool->found);
+  if(pool->old)free(pool->old);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->w);
+  free(pool);
+}
+
 /* ===========================================================================
  * i_stage1() (internal)
  *
@@ -689,6 +976,25 @@ static long i_stage1(cdrom_paranoia *p,c_block *new,
   int ret=0;
   long begin=0,end;
   
+  /* If the matching was already done while reading ahead, and against
+   * the same c_blocks, it only remains to take up the results.
+   */
+  if(i_stage1_ahead_adopt(p,new,callback))
+    ptr=NULL;
+
+  /* Compare against all the old c_blocks at once? */
+  if(ptr && ptr!=new && p->stage1pool){
+    c_block **old;
+    c_block *c;
+    long n=0;
+
+    for(c=ptr;c!=new;c=c_prev(c))n++;
+    old=i_stage1_olds(p->stage1pool,n);
+    for(n=0,c=ptr;c!=new;c=c_prev(c))old[n++]=c;
+    i_stage1_parallel(p,n,new,callback);
+    ptr=NULL;
+  }
+
   /* We're going to be comparing the new c_block against the other
    * c_blocks in memory.  Initialize the "sort cache" index to allow
    * for fast searching through the new c_block.  (The index will
@@ -766,6 +1072,39 @@ typedef struct sync_result {
    Do *not* match using zero posts
 */
 
+/* ===========================================================================
+ * i_stage2_sync (internal)
+ *
+ * Called when the fragment's sample at the absolute position (post)
+ * equals the root's sample at offset (match) within the root.  Grows
+ * the matching run backward and forward; if it is long enough (longer
+ * than MIN_WORDS_SEARCH) to be more than coincidence, fills in the
+ * sync_result and returns 1.  Otherwise returns 0.
+ *
+ * (begin) and (end) are the absolute boundaries of the run in the root,
+ * and (offset) is how far the fragment is out of sync with the root:
+ * if the fragment's sample 10 corresponds to the root's 12, the offset
+ * is -2.  This is opposite in sign to try_sort_sync()'s, which is what
+ * offset_add_value() keeps track of.
+ */
+static inline long i_stage2_sync(cdrom_paranoia *p,v_fragment *v,
+				 long post,long match,sync_result *r,
+				 void(*callback)(long,int)){
+  root_block *root=&(p->root);
+  long begin,end;
+
+  if(i_paranoia_overlap(rv(root),fv(v),match,post-fb(v),
+			rs(root),fs(v),&begin,&end)<=MIN_WORDS_SEARCH)
+    return(0);
+
+  r->begin=begin+rb(root);
+  r->end=end+rb(root);
+  r->offset=post-(match+rb(root));
+  offset_add_value(p,&(p->stage1),-r->offset,callback);
+  if(r->offset)if(callback)(*callback)(r->begin,PARANOIA_CB_FIXUP_EDGE);
+  return(1);
+}
+
 /* ===========================================================================
  * i_iterate_stage2 (internal)
  *
@@ -795,7 +1134,6 @@ typedef struct sync_result {
 static long i_iterate_stage2(cdrom_paranoia *p,v_fragment *v,
 			     sync_result *r,void(*callback)(long,int)){
   root_block *root=&(p->root);
-  long matchbegin=-1,matchend=-1,offset;
   long fbv,fev;
   
 #ifdef NOISY
@@ -846,73 +1184,53 @@ static long i_iterate_stage2(cdrom_paranoia *p,v_fragment *v,
   fev=min(min(fbv+256,re(root)+p->dynoverlap),fe(v));
   
   {
-    /* Because we'll allow for up to (p->dynoverlap) jitter between the
-     * fragment and the root, we expand the search area (fbv to fev) by
-     * p->dynoverlap on both sides.  But, because we're iterating through
-     * root, we need to constrain the search area not to extend beyond
-     * the root's boundaries.
+    /* The root is already indexed (see i_stage2()), so rather than
+     * index the fragment and probe it from posts all through the root,
+     * we post from the fragment and look each post up in the root,
+     * within (p->dynoverlap) samples of where the fragment claims it
+     * is.
      */
-    long searchend=min(fev+p->dynoverlap,re(root));
-    long searchbegin=max(fbv-p->dynoverlap,rb(root));
-    sort_info *i=p->sortcache;
+    sort_info *i=p->rootsort;
     long j;
-    
-    /* Initialize the "sort cache" index to allow for fast searching
-     * through the verified fragment between (fbv,fev).  (The index will
-     * actually be built the first time we search.)
-     */
-    sort_setup(i,fv(v),&fb(v),fs(v),fbv,fev);
 
-    for(j=searchbegin;j<searchend;j+=23){
+    for(j=fbv;j<fev;j+=23){
+      int16_t *value;
+      long match;
 
-      /* Skip past silence in the root.  If there are just a few silent
-       * samples, the effect is minimal.  The real reason we need this is
-       * for large regions of silence.  All silence looks alike, so you
-       * could false-positive "match" two runs of silence that are either
-       * unrelated or ought to be jittered, and try_sort_sync can't
+      /* Skip past silence in the fragment.  If there are just a few
+       * silent samples, the effect is minimal.  The real reason we need
+       * this is for large regions of silence.  All silence looks alike,
+       * so you could false-positive "match" two runs of silence that
+       * are either unrelated or ought to be jittered, and we can't
        * accurately determine jitter (offset) from silence.
        *
        * Therefore, we want to post on a non-zero sample.  If there's
-       * nothing but silence left in the root, bail.  We don't want
-       * to match it here.
+       * nothing but silence left in the search area, bail.  We don't
+       * want to match it here.
        */
-      while(j<searchend && rv(root)[j-rb(root)]==0)j++;
-      if(j==searchend)break;
+      while(j<fev && fv(v)[j-fb(v)]==0)j++;
+      if(j==fev)break;
+      value=fv(v)+(j-fb(v));
 
-      /* Starting from the (non-zero) sample in the root with the absolute
-       * position j, look for a matching run in the verified fragment.  This
-       * search will look a certain distance around j, and if successful
-       * will extend the matching run as far backward and forward as
-       * it can.
-       *
-       * The search will only return 1 if it finds a matching run long
-       * enough to be deemed significant.  Note that the search is limited
-       * by the boundaries given to sort_setup() above.
-       *
-       * Note also that flags aren't used in stage 2 (since neither verified
-       * fragments nor the root have them).
+      /* Always try absolute offset zero first!  If there's no jitter
+       * at all, the root's sample at the same position will match.
        */
-      if(try_sort_sync(p,i,NULL,rc(root),j,
-		       &matchbegin,&matchend,&offset,callback)){
-	
-	/* If we found a matching run, we return the results of our match.
-	 *
-	 * Note that we flip the sign of (offset) because try_sort_sync()
-	 * returns it in terms of the fragment (i.e. what we add
-	 * to the fragment's position to yield the corresponding position
-	 * in the root), but here we consider the root to be canonical,
-	 * and so our returned "offset" reflects how the fragment is offset
-	 * from the root.
-	 *
-	 * E.g.: If the fragment's sample 10 corresponds to root's 12,
-	 * try_sort_sync() would return 2.  But since root is canonical,
-	 * we say that the fragment is off by -2.
-	 */
-	r->begin=matchbegin;
-	r->end=matchend;
-	r->offset=-offset;
-	if(offset)if(callback)(*callback)(r->begin,PARANOIA_CB_FIXUP_EDGE);
+      match=j-rb(root);
+      if(match>=0 && match<rs(root) && rv(root)[match]==*value &&
+	 i_stage2_sync(p,v,j,match,r,callback))
 	return(1);
+
+      /* Otherwise look for the post's samples in the root.  Each hit is
+       * grown in both directions; if the matching run is long enough to
+       * be deemed significant, we're done.  Note that flags aren't used
+       * in stage 2 (since neither verified fragments nor the root have
+       * them).
+       */
+      match=sort_getmatch(i,j-rb(root),p->dynoverlap,value,fe(v)-j);
+      while(match>=0){
+	if(i_stage2_sync(p,v,j,match,r,callback))
+	  return(1);
+	match=sort_nextmatch(i,match);
       }
     }
   }
@@ -1849,11 +2167,7 @@ static int i_init_root(root_block *root, v_fragment *v,long begin,
       rc(root)=NULL;
     }
 
-    {
-      int16_t *buff=malloc(fs(v)*sizeof(int16_t));
-      memcpy(buff,fv(v),fs(v)*sizeof(int16_t));
-      root->vector=c_alloc(buff,fb(v),fs(v));
-    }    
+    root->vector=c_ring_alloc(fv(v),fb(v),fs(v));
 
     /* Check whether the new root has a long span of trailing silence.
      */
@@ -1864,10 +2178,27 @@ static int i_init_root(root_block *root, v_fragment *v,long begin,
     return(0);
 }
 
-static int vsort(const void *a,const void *b){
-  return((*(v_fragment **)a)->begin-(*(v_fragment **)b)->begin);
-}
+/* ===========================================================================
+ * i_stage2_index (internal)
+ *
+ * Brings the stage 2 index (p->rootsort) up to date with the root, which
+ * i_stage2() does each time the root may have changed.  The index is
+ * persistent: the root's c_block notes the first sample altered since
+ * the last update (usually the start of what was appended), and tiles
+ * before that are kept as they are.  Tiles are only built as searches
+ * reach them, and stage 2 searches only where fragments overlap the
+ * root, which is nearly always its tail; so extending the root indexes
+ * little more than what was added to it.
+ */
+static void i_stage2_index(cdrom_paranoia *p){
+  root_block *root=&(p->root);
 
+  if(rv(root)){
+    sort_update(p->rootsort,rv(root),&cb(rc(root)),rs(root),
+		rb(root),re(root),rc(root)->changed);
+    rc(root)->changed=re(root);
+  }
+}
 
 /* ===========================================================================
  * i_stage2 (internal)
@@ -1901,10 +2232,15 @@ static int i_stage2(cdrom_paranoia *p,long beginword,long endword,
   root_block *root=&(p->root);
 
 #ifdef NOISY
-  fprintf(stderr,"Fragments:%ld\n",p->fragments->active);
+  fprintf(stderr,"Fragments:%ld\n",v_count(p));
   fflush(stderr);
 #endif
 
+  /* The root has likely grown or been trimmed since we were last here.
+   * After this it only changes when we merge a fragment into it.
+   */
+  i_stage2_index(p);
+
   /* even when the 'silence flag' is lit, we try to do non-silence
      matching in the event that there are still audio vectors with
      content to be sunk before the silence */
@@ -1916,31 +2252,20 @@ static int i_stage2(cdrom_paranoia *p,long beginword,long endword,
    */
   while(flag){
 
-    /* Convert the linked list of verified fragments into an array,
-     * to be sorted in order of beginning sample position
+    /* The verified fragments are already kept in order of beginning
+     * sample position.  Merging a fragment frees it and closes up the
+     * list behind it, so we only step past fragments we leave there.
      */
-    v_fragment *first=v_first(p);
-    long active=p->fragments->active,count=0;
-    v_fragment *list[active];
-
-    while(first){
-      v_fragment *next=v_next(first);
-      list[count++]=first;
-      first=next;
-    }
+    v_fragment *first;
+    long count;
 
     /* Reset the flag so that if we don't match any fragments, we
      * stop looping.  Then, proceed only if there are any fragments
      * to match.
      */
     flag=0;
-    if(count){
+    if(v_count(p)){
 
-      /* Sort the array of verified fragments in order of beginning
-       * sample position.
-       */
-      qsort(list,active,sizeof(v_fragment *),&vsort);
-      
       /* We don't check for the silence flag yet, because even if the
        * verified root ends in silence (and thus the silence flag is set),
        * there may be a non-silent region at the beginning of the verified
@@ -1950,62 +2275,63 @@ static int i_stage2(cdrom_paranoia *p,long beginword,long endword,
       /* Iterate through the verified fragments, starting at the fragment
        * with the lowest beginning sample position.
        */
-      for(count=0;count<active;count++){
-	first=list[count];
+      count=0;
+      while((first=v_get(p,count))){
 
-	/* Make sure this fragment hasn't already been merged (and
-	 * thus freed). */
-	if(first->one){
+	/* If we don't have a verified root yet, just promote the first
+	 * fragment (with lowest beginning sample) to be the verified
+	 * root.
+	 *
+	 * "??? It seems that this could be fairly arbitrary if jitter
+	 * is an issue.  If we've verified two fragments allegedly
+	 * beginning at "0" (which are actually slightly offset due to
+	 * jitter), the root might not begin at the earliest read
+	 * sample.  Additionally, because subsequent fragments are
+	 * only merged at the tail end of the root, this situation
+	 * won't be fixed by merging the earlier samples.
+	 *
+	 * Practically, this ends up not being critical since most
+	 * drives insert some extra silent samples at the beginning
+	 * of the stream.  Missing a few of them doesn't cause any
+	 * real lost data.  But it is non-deterministic." 
+	 *
+	 * On such a drive, the entire act of CDDA read is highly
+	 * nondeterministic.  All redbook says is +/- 75 sectors.
+	 * If you insist on the earliest possible sample, you can
+	 * get into a situation where the first read was far earlier
+	 * than all the others and no other read ever repeats the
+	 * early positioning. --Monty */
+
+	if(rv(root)==NULL){
+	  if(i_init_root(&(p->root),first,beginword,callback)){
+	    free_v_fragment(first);
+	    i_stage2_index(p);
+
+	    /* Consider this a merged fragment, so set the flag
+	     * to keep looping.
+	     */
+	    flag=1;
+	    ret++;
+	  }
+	}else{
 
-	  /* If we don't have a verified root yet, just promote the first
-	   * fragment (with lowest beginning sample) to be the verified
-	   * root.
-	   *
-	   * "??? It seems that this could be fairly arbitrary if jitter
-	   * is an issue.  If we've verified two fragments allegedly
-	   * beginning at "0" (which are actually slightly offset due to
-	   * jitter), the root might not begin at the earliest read
-	   * sample.  Additionally, because subsequent fragments are
-	   * only merged at the tail end of the root, this situation
-	   * won't be fixed by merging the earlier samples.
-	   *
-	   * Practically, this ends up not being critical since most
-	   * drives insert some extra silent samples at the beginning
-	   * of the stream.  Missing a few of them doesn't cause any
-	   * real lost data.  But it is non-deterministic." 
-	   *
-	   * On such a drive, the entire act of CDDA read is highly
-	   * nondeterministic.  All redbook says is +/- 75 sectors.
-	   * If you insist on the earliest possible sample, you can
-	   * get into a situation where the first read was far earlier
-	   * than all the others and no other read ever repeats the
-	   * early positioning. --Monty */
-
-	  if(rv(root)==NULL){
-	    if(i_init_root(&(p->root),first,beginword,callback)){
-	      free_v_fragment(first);
-
-	      /* Consider this a merged fragment, so set the flag
-	       * to keep looping.
-	       */
-	      flag=1;
-	      ret++;
-	    }
-	  }else{
+	  /* Try to merge this fragment with the verified root,
+	   * extending the tail of the root.
+	   */
+	  if(i_stage2_each(root,first,callback)){
 
-	    /* Try to merge this fragment with the verified root,
-	     * extending the tail of the root.
+	    /* If we successfully merged the fragment, set the flag
+	     * to keep looping.
 	     */
-	    if(i_stage2_each(root,first,callback)){
-
-	      /* If we successfully merged the fragment, set the flag
-	       * to keep looping.
-	       */
-	      ret++;
-	      flag=1;
-	    }
+	    ret++;
+	    flag=1;
+	    i_stage2_index(p);
 	  }
 	}
+
+	/* Unless it was merged (or discarded), leave this fragment for
+	 * a later pass and move on to the next. */
+	if(v_get(p,count)==first)count++;
       }
 
       /* If the verified root ends in a long span of silence, iterate
@@ -2013,34 +2339,31 @@ static int i_stage2(cdrom_paranoia *p,long beginword,long endword,
        * merged using our special silence matching.
        */
       if(!flag && p->root.silenceflag){
-	for(count=0;count<active;count++){
-	  first=list[count];
-
-	  /* Make sure this fragment hasn't already been merged (and
-	   * thus freed). */
-	  if(first->one){
-	    if(rv(root)!=NULL){
-
-	      /* Try to merge the fragment into the root.  This will only
-	       * succeed if the fragment overlaps and begins with sufficient
-	       * silence to be a presumed match.
-	       *
-	       * Note that the fragments must be passed to i_silence_match()
-	       * in ascending order, as they are here.
-	       */
-	      if(i_silence_match(root,first,callback)){
+	count=0;
+	while((first=v_get(p,count))){
+	  if(rv(root)!=NULL){
 
-		/* If we successfully merged the fragment, set the flag
-		 * to keep looping.
-		 */
-		ret++;
-		flag=1;
-	      }
+	    /* Try to merge the fragment into the root.  This will only
+	     * succeed if the fragment overlaps and begins with sufficient
+	     * silence to be a presumed match.
+	     *
+	     * Note that the fragments must be passed to i_silence_match()
+	     * in ascending order, as they are here.
+	     */
+	    if(i_silence_match(root,first,callback)){
+
+	      /* If we successfully merged the fragment, set the flag
+	       * to keep looping.
+	       */
+	      ret++;
+	      flag=1;
+	      i_stage2_index(p);
 	    }
 	  }
-	} /* end for */
+	  if(v_get(p,count)==first)count++;
+	} /* end while */
       }
-    } /* end if(count) */
+    } /* end if(v_count(p)) */
 
     /* If we were able to extend the verified root at all during this pass
      * through the loop, loop again to see if we can merge any remaining
@@ -2152,9 +2475,7 @@ static void verify_skip_case(cdrom_paranoia *p,void(*callback)(long,int)){
       gend=min(gend+OVERLAP_ADJ,cend);
 
       if(rv(root)==NULL){
-	int16_t *buff=malloc(cs(graft));
-	memcpy(buff,cv(graft),cs(graft));
-	rc(root)=c_alloc(buff,cb(graft),cs(graft));
+	rc(root)=c_ring_alloc(cv(graft),cb(graft),cs(graft));
       }else{
 	c_append(rc(root),cv(graft)+post-cbegin,
 		 gend-post);
@@ -2170,11 +2491,11 @@ static void verify_skip_case(cdrom_paranoia *p,void(*callback)(long,int)){
     void *temp=calloc(CD_FRAMESIZE_RAW,sizeof(int16_t));
 
     if(rv(root)==NULL){
-      rc(root)=c_alloc(temp,post,CD_FRAMESIZE_RAW);
+      rc(root)=c_ring_alloc(temp,post,CD_FRAMESIZE_RAW);
     }else{
       c_append(rc(root),temp,CD_FRAMESIZE_RAW);
-      free(temp);
     }
+    free(temp);
 
     root->returnedlimit=re(root);
   }
@@ -2182,15 +2503,23 @@ static void verify_skip_case(cdrom_paranoia *p,void(*callback)(long,int)){
 
 /**** toplevel ****************************************/
 
+static void i_readahead_cancel(cdrom_paranoia *p);
+
 void paranoia_free(cdrom_paranoia *p){
+  paranoia_readahead(p,0);
+  paranoia_threads(p,1);
   paranoia_resetall(p);
   sort_free(p->sortcache);
+  sort_free(p->rootsort);
   free_list(p->cache, 1);
-  free_list(p->fragments, 1);
+  free(p->fragments.v);
+  c_slab_free(p);
   free(p);
 }
 
 void paranoia_modeset(cdrom_paranoia *p,int enable){
+  /* a read-ahead was planned under the old mode */
+  i_readahead_cancel(p);
   p->enable=enable;
 }
 
@@ -2211,6 +2540,7 @@ long paranoia_seek(cdrom_paranoia *p,long seek,int mode){
   
   if(cdda_sector_gettrack(p->d,sector)==-1)return(-1);
 
+  i_readahead_cancel(p);
   i_cblock_destructor(p->root.vector);
   p->root.vector=NULL;
   p->root.lastsector=0;
@@ -2227,60 +2557,889 @@ long paranoia_seek(cdrom_paranoia *p,long seek,int mode){
   return(ret);
 }
 
-static void cdrom_cache_update(cdrom_paranoia *p, int lba, int sectors){
+/**** Read spans *********************************************************/
+
+/* A read span is the series of low-level reads that fills one c_block.
+ * It carries everything those reads depend on, including its own copy
+ * of the drive cache model, so that a span can be read on another
+ * thread as well as inline; see the read-ahead section below.
+ */
+
+/* the most reads a span keeps outstanding at once (the interface may
+   allow fewer; see cdda_read_queue_depth()) */
+#define MAX_SPAN_QUEUE 4
+
+typedef struct c_readcb{
+  long pos;
+  int mode;
+} c_readcb;
+
+typedef struct c_readspan{
+  cdrom_drive *d;
+
+  /* the plan */
+  long readat;          /* first sector, jiggled and drift compensated */
+  long totaltoread;
+  long sectatonce;
+  long firstsector;     /* bounds of the audio session */
+  long lastsector;
+  int cdcache_size;     /* the drive cache model, updated as we read */
+  int cdcache_begin;
+  int cdcache_end;
+
+  /* callbacks are made as we go, or saved for later if (deferred) */
+  void (*callback)(long,int);
+  int deferred;
+  c_readcb *cb;
+  long cbcount;
+  long cballoc;
+
+  /* the result */
+  int16_t *buffer;
+  unsigned char *flags;
+  long firstread;
+  long sofar;
+  int anyflag;
+  int lastread;         /* the span reached the end of the session */
+  int err;
+  long usec;            /* how long the reads took... */
+  long good;            /* ...and how many sectors they actually read */
+  long readerrs;        /* reads that failed outright */
+  long shorts;          /* reads that came back with fewer sectors */
+} c_readspan;
+
+static long i_readsize(cdrom_paranoia *p);
+
+static void i_span_init(cdrom_paranoia *p,c_readspan *s,long readat){
+  memset(s,0,sizeof(*s));
+  s->d=p->d;
+  s->readat=readat;
+  s->totaltoread=p->cdcache_size;
+  s->sectatonce=i_readsize(p);
+  s->firstsector=p->current_firstsector;
+  s->lastsector=p->current_lastsector;
+  s->cdcache_size=p->cdcache_size;
+  s->cdcache_begin=p->cdcache_begin;
+  s->cdcache_end=p->cdcache_end;
+  s->firstread=-1;
+}
+
+/* would the two spans issue exactly the same reads? */
+static int i_span_same(c_readspan *a,c_readspan *b){
+  return(a->readat==b->readat &&
+	 a->totaltoread==b->totaltoread &&
+	 a->sectatonce==b->sectatonce &&
+	 a->firstsector==b->firstsector &&
+	 a->lastsector==b->lastsector &&
+	 a->cdcache_size==b->cdcache_size &&
+	 a->cdcache_begin==b->cdcache_begin &&
+	 a->cdcache_end==b->cdcache_end);
+}
+
+static void i_span_callback(c_readspan *s,long pos,int mode){
+  if(s->deferred){
+    if(s->cbcount>=s->cballoc){
+      s->cballoc=(s->cballoc?s->cballoc*2:64);
+      s->cb=realloc(s->cb,s->cballoc*sizeof(*s->cb));
+    }
+    s->cb[s->cbcount].pos=pos;
+    s->cb[s->cbcount].mode=mode;
+    s->cbcount++;
+  }else
+    if(s->callback)(*s->callback)(pos,mode);
+}
+
+static void cdrom_cache_update(c_readspan *s, int lba, int sectors){
 
-  if(lba+sectors > p->cdcache_size){
+  if(lba+sectors > s->cdcache_size){
     int end = lba+sectors;
-    lba=end-p->cdcache_size;
+    lba=end-s->cdcache_size;
     sectors = end-lba;
   }
     
-  if(lba < p->cdcache_begin){
+  if(lba < s->cdcache_begin){
     /* a backseek flushes the cache */
-    p->cdcache_begin=lba;
-    p->cdcache_end=lba+sectors;
+    s->cdcache_begin=lba;
+    s->cdcache_end=lba+sectors;
   }else{
-    if(lba+sectors>p->cdcache_end)
-      p->cdcache_end = lba+sectors;
-    if(lba+sectors-p->cdcache_size > p->cdcache_begin){
-      if(lba+sectors-p->cdcache_size < p->cdcache_end){
-	p->cdcache_begin = lba+sectors-p->cdcache_size;
+    if(lba+sectors>s->cdcache_end)
+      s->cdcache_end = lba+sectors;
+    if(lba+sectors-s->cdcache_size > s->cdcache_begin){
+      if(lba+sectors-s->cdcache_size < s->cdcache_end){
+	s->cdcache_begin = lba+sectors-s->cdcache_size;
       }else{
-	p->cdcache_begin = lba;
+	s->cdcache_begin = lba;
       }
     }
   }
 }
 
-static void cdrom_cache_handler(cdrom_paranoia *p, int lba, void(*callback)(long,int)){
+static void cdrom_cache_handler(c_readspan *s, int lba){
   int seekpos;
   int ms;
-  if(lba>=p->cdcache_end)return; /* nothing to do */
+  if(lba>=s->cdcache_end)return; /* nothing to do */
 
   if(lba<0)lba=0;
 
-  if(lba<p->cdcache_begin){
+  if(lba<s->cdcache_begin){
     /* should always trigger a backseek so let's do that here and look for the timing */
-    seekpos=(lba==0 || lba-1<cdda_disc_firstsector(p->d) ? lba : lba-1); /* keep reads linear when possible */
+    seekpos=(lba==0 || lba-1<cdda_disc_firstsector(s->d) ? lba : lba-1); /* keep reads linear when possible */
   }else{
-    int pre = p->cdcache_begin-1;
-    int post = lba+p->cdcache_size;
+    int pre = s->cdcache_begin-1;
+    int post = lba+s->cdcache_size;
 
-    seekpos = (pre<cdda_disc_firstsector(p->d) ? post : pre);
+    seekpos = (pre<cdda_disc_firstsector(s->d) ? post : pre);
   }
 
-  if(cdda_read_timed(p->d,NULL,seekpos,1,&ms)==1)
-    if(seekpos<p->cdcache_begin && ms<MIN_SEEK_MS)
-      callback(seekpos*CD_FRAMEWORDS,PARANOIA_CB_CACHEERR);
-  cdrom_cache_update(p,seekpos,1);
+  if(cdda_read_timed(s->d,NULL,seekpos,1,&ms)==1)
+    if(seekpos<s->cdcache_begin && ms<MIN_SEEK_MS)
+      i_span_callback(s,seekpos*CD_FRAMEWORDS,PARANOIA_CB_CACHEERR);
+  cdrom_cache_update(s,seekpos,1);
   return;
 }
 
+/* Work out the next low-level read of a span, starting from *readat
+ * with (sofar) sectors already planned.  Returns 0 once there are no
+ * more to issue.
+ */
+static int i_span_request(c_readspan *s,long *readat,long sofar,
+			  long *adjread,long *secread){
+  while(sofar<s->totaltoread){
+    long n=s->sectatonce;  /* number of sectors to read this request */
+    long at=*readat;       /* first sector to read for this request */
+
+    /* don't under/overflow the audio session */
+    if(at<s->firstsector){
+      n-=s->firstsector-at;
+      at=s->firstsector;
+    }
+    if(at+n-1>s->lastsector)
+      n=s->lastsector-at+1;
+    
+    if(sofar+n>s->totaltoread)n=s->totaltoread-sofar;
+    
+    if(n>0){
+      *adjread=at;
+      *secread=n;
+      *readat=at+n;
+      return(1);
+    }
+
+    if(*readat<s->firstsector)
+      *readat+=s->sectatonce; /* due to being before the readable area */
+    else
+      break; /* due to being past the readable area */
+  }
+  return(0);
+}
+
+/* Issue the low-level reads of a span into its buffer (and flags, if
+ * it has them).  See i_read_c_block() for the why of all this.
+ */
+static void i_read_span(c_readspan *s){
+  long readat=s->readat;
+  int16_t *buffer=s->buffer;
+  unsigned char *flags=s->flags;
+  long sofar=0;
+
+  /* reads submitted to the drive and not yet seen to */
+  long qread[MAX_SPAN_QUEUE];
+  long qsect[MAX_SPAN_QUEUE];
+  int qhead=0,qcount=0;
+  int depth=cdda_read_queue_depth(s->d);
+  long adjread;             /* first sector to read for this request */
+  long secread;             /* number of sectors to read this request */
+  long subat=readat,subsofar=0;
+  struct timespec t0,t1;
+
+  if(depth>MAX_SPAN_QUEUE)depth=MAX_SPAN_QUEUE;
+
+  /* we have a read span; flush the drive cache if needed */
+  cdrom_cache_handler(s, readat);
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+
+  /* Issue each of the low-level reads; the optimal read size is
+   * approximately the cachemodel's cdrom cache size.  The only reason
+   * to read less would be memory considerations.
+   *
+   * p->cdcache_size = total number of sectors to read
+   * p->d->nsectors = number of sectors to read per request
+   *
+   * Where the drive's interface can queue commands, keep up to (depth)
+   * of them outstanding, so the drive goes straight on from one to the
+   * next rather than waiting on us for a round trip each time.  The
+   * results are still seen to one at a time and in order.
+   */
+
+  /* actual read loop */
+
+  while(1){
+    long thisread;            /* how many sectors were read this request */
+
+    while(qcount<depth && i_span_request(s,&subat,subsofar,&adjread,&secread)){
+      int slot=(qhead+qcount)%MAX_SPAN_QUEUE;
+      if(cdda_read_submit(s->d,buffer+subsofar*CD_FRAMEWORDS,adjread,secread))
+	break;
+      qread[slot]=adjread;
+      qsect[slot]=secread;
+      qcount++;
+      subsofar+=secread;
+    }
+    if(qcount==0)break;
+
+    adjread=qread[qhead];
+    secread=qsect[qhead];
+    qhead=(qhead+1)%MAX_SPAN_QUEUE;
+    qcount--;
+      
+    if(s->firstread<0)s->firstread=adjread;
+
+    /* Reap the low-level read from the driver.
+     */
+
+    /* If the low-level read returned too few sectors, pad the result
+     * with null data and mark it as invalid (FLAGS_UNREAD).  We pad
+     * because we're going to be appending further reads to the current
+     * c_block.
+     *
+     * "???: Why not re-read?  It might be to keep you from getting
+     * hung up on a bad sector.  Or it might be to avoid
+     * interrupting the streaming as much as possible."  
+     *
+     * There are drives on which you will never get a full read in
+     * some positions.  They always abort out early due to firmware
+     * boundary cases.  Reread will cause exactly the same thing to
+     * happen again.  NEC MultiSpeed 4x is one such drive. In these
+     * cases, you take what part of the read you know is good, and
+     * you get substantially better performance. --Monty
+     */
+
+    if((thisread=cdda_read_reap(s->d))<secread){
+
+      if(thisread<0){
+	if(errno==ENOMEDIUM){
+	  /* the one error we bail on immediately */
+	  s->err=ENOMEDIUM;
+	  while(qcount--)cdda_read_reap(s->d);
+	  break;
+	}
+	thisread=0;
+	s->readerrs++;
+      }else
+	s->shorts++;
+
+      /* Uhhh... right.  Make something up. But don't make us seek
+	 backward! */
+
+      i_span_callback(s,(adjread+thisread)*CD_FRAMEWORDS,PARANOIA_CB_READERR);  
+      memset(buffer+(sofar+thisread)*CD_FRAMEWORDS,0,
+	     CD_FRAMESIZE_RAW*(secread-thisread));
+      if(flags)memset(flags+(sofar+thisread)*CD_FRAMEWORDS,FLAGS_UNREAD,
+		      CD_FRAMEWORDS*(secread-thisread));
+    }
+    if(thisread!=0)s->anyflag=1;
+    s->good+=thisread;
+      
+
+    /* Because samples are likely to be dropped between read requests,
+     * mark the samples near the the boundaries of the read requests
+     * as suspicious (FLAGS_EDGE).  This means that any span of samples
+     * against which these adjacent read requests are compared must
+     * overlap beyond the edges and into the more trustworthy data.
+     * Such overlapping spans are accordingly at least MIN_WORDS_OVERLAP
+     * words long (and naturally longer if any samples were dropped
+     * between the read requests).
+     *
+     *          (EEEEE...overlapping span...EEEEE)
+     * (read 1 ...........EEEEE)   (EEEEE...... read 2 ......EEEEE) ...
+     *         dropped samples --^
+     */
+    if(flags && sofar!=0){
+      /* Don't verify across overlaps that are too close to one
+	 another */
+      int i=0;
+      for(i=-MIN_WORDS_OVERLAP/2;i<MIN_WORDS_OVERLAP/2;i++)
+	flags[sofar*CD_FRAMEWORDS+i]|=FLAGS_EDGE;
+    }
+
+    if(adjread+secread-1==s->lastsector)
+      s->lastread=1;
+      
+    i_span_callback(s,(adjread+secread-1)*CD_FRAMEWORDS,PARANOIA_CB_READ);
+      
+    cdrom_cache_update(s,adjread,secread);
+    sofar+=secread;
+  }
+
+  s->sofar=sofar;
+  clock_gettime(CLOCK_MONOTONIC,&t1);
+  s->usec=(t1.tv_sec-t0.tv_sec)*1000000L+(t1.tv_nsec-t0.tv_nsec)/1000;
+}
+
+/**** Read size **********************************************************/
+
+/* The interface's d->nsectors is the most a drive will take in one
+ * read, not necessarily what reads fastest: some drives lose streaming
+ * or fail outright on large requests, others do best with the largest
+ * they'll take, and either may change across the disc.  With adaptive
+ * reads enabled, the size of the low-level reads is tuned as we go:
+ *
+ * - a read that fails outright is taken as the drive refusing the
+ *   size, and the size is halved at once;
+ * - otherwise each span's throughput is measured.  Short reads count
+ *   only the sectors that arrived, so a drive that always stops a
+ *   sector early isn't punished for it any more than it has to be.
+ *   The throughput over READSIZE_SPANS spans at the current size
+ *   becomes the baseline;
+ * - then we probe a quarter bigger (or smaller).  A probe that beats
+ *   the baseline by READSIZE_MARGIN percent is kept and we go on the
+ *   same way; one that doesn't is abandoned, and after letting
+ *   READSIZE_WAIT spans go by, the next probe goes the other way.
+ *   After a back-off, the size grows back a probe at a time as long as
+ *   reads keep succeeding, all the way to where it started; throughput
+ *   alone would leave a drive whose speed hardly depends on the size
+ *   stuck at half of it for good.
+ *
+ * The interface may lower d->nsectors itself (scsi_read_map() does when
+ * the kernel runs short of memory); that is a back-off like any other,
+ * and later probes may raise d->nsectors again, as far as it was when
+ * adaptive reads were turned on.
+ *
+ * The size only changes as a span is taken up by i_read_c_block(), so
+ * that a read-ahead is always planned with the size the read it
+ * stands in for will be.
+ */
+
+#define READSIZE_SPANS   2
+#define READSIZE_WAIT    8
+#define READSIZE_MARGIN  3
+#define READSIZE_READS   4   /* the fewest in a span worth measuring */
+
+static long i_readsize(cdrom_paranoia *p){
+  long n=p->d->nsectors;
+  if(p->readsize.enabled && p->readsize.size<n)
+    n=p->readsize.size;
+  return(n);
+}
+
+/* the size a probe from (size) in direction (dir) would try */
+static long i_readsize_probe(cdrom_paranoia *p,long size,int dir){
+  long step=max(size/4,1);
+  return(max(min(size+dir*step,p->readsize.max),1));
+}
+
+/* start over from (size), and grow back in a while */
+static void i_readsize_backoff(c_readsize *r,long size){
+  r->size=r->base=max(size,1);
+  r->baserate=0;
+  r->dir=1;
+  r->probing=0;
+  r->recovering=1;
+  r->wait=READSIZE_WAIT;
+  r->spans=r->sectors=r->usec=0;
+}
+
+static void i_readsize_update(cdrom_paranoia *p,c_readspan *s){
+  c_readsize *r=&p->readsize;
+  cdrom_drive *d=p->d;
+  long rate;
+
+  if(!r->enabled)return;
+
+  if(d->nsectors<s->sectatonce){
+    /* the interface backed off on its own */
+    i_readsize_backoff(r,d->nsectors);
+    return;
+  }
+  if(s->readerrs && s->sectatonce>1){
+    i_readsize_backoff(r,s->sectatonce/2);
+    return;
+  }
+
+  /* a span of only a few reads says more about seeking than reading */
+  if(s->sofar<READSIZE_READS*s->sectatonce)return;
+  if(r->wait){
+    r->wait--;
+    return;
+  }
+
+  r->sectors+=s->good;
+  r->usec+=s->usec;
+  if(++r->spans<READSIZE_SPANS)return;
+  rate=(r->usec>0?(double)r->sectors*1000000./r->usec:0);
+  r->spans=r->sectors=r->usec=0;
+
+  if(r->probing){
+    if(r->recovering || rate*100>r->baserate*(100+READSIZE_MARGIN)){
+      /* keep it, and carry on */
+      r->base=r->size;
+      r->baserate=rate;
+    }else{
+      /* back to where we were; try the other way next */
+      r->size=r->base;
+      r->probing=0;
+      r->dir=-r->dir;
+      r->wait=READSIZE_WAIT;
+      return;
+    }
+  }else
+    r->baserate=rate;
+
+  r->size=i_readsize_probe(p,r->base,r->dir);
+  if(r->size==r->base){
+    r->recovering=0;
+    r->dir=-r->dir;
+    r->size=i_readsize_probe(p,r->base,r->dir);
+  }
+  r->probing=(r->size!=r->base);
+  if(!r->probing)r->wait=READSIZE_WAIT;
+
+  if(r->size>d->nsectors){
+    d->nsectors=r->size;
+    d->bigbuff=d->nsectors*CD_FRAMESIZE_RAW;
+  }
+}
+
+/**** Read-ahead *********************************************************/
+
+/* Left to itself, the drive sits idle while the application consumes
+ * the verified root, and paranoia sits idle while the drive reads.
+ * With read-ahead enabled, as paranoia_read_limited() returns we work
+ * out the span that i_read_c_block() would read next and start reading
+ * it on a thread of its own.
+ *
+ * That guess is exact unless something changes before the next read:
+ * the root grows from fragments already at hand, the application
+ * seeks, the cache model is resized, and so on.  So when the next read
+ * comes due, we plan it afresh as usual, wait for the read-ahead, and
+ * use it only if it was planned the same way; the drive then sees
+ * exactly the same reads, jiggle and cache busting as it would
+ * without read-ahead.  Otherwise the read-ahead is thrown away (though
+ * its reads are still entered in the cache model, as they did happen)
+ * and we read as usual.
+ *
+ * One span is read ahead at most: each one is planned from the root
+ * that verifying the last one left behind.
+ *
+ * The thread reads through a copy of the cdrom_drive, so that the
+ * application can collect cdda_messages() and cdda_errors() from the
+ * original meanwhile.  Its callbacks, messages and any changes to the
+ * drive state are handed back once it is done.
+ */
+
+/* In VERIFY mode, once the span is read the thread goes on to run
+ * stage 1 on it, against the c_blocks the cache will hold when it is
+ * verified in earnest; the main thread meanwhile runs stage 2 on the
+ * fragments of earlier reads, and the application consumes the root.
+ *
+ * Stage 1 works on a copy of the cdrom_paranoia (for the jitter
+ * statistics and a sort cache of its own) and of each old c_block's
+ * bounds, and it leaves the old c_blocks' flags alone: the samples it
+ * would mark verified there are noted, as are its callbacks.  The old
+ * c_blocks are pinned, so that trimming the cache meanwhile doesn't
+ * free them from under it.
+ *
+ * The result stands if, when the span is collected, stage 1 proper
+ * would have started from the same state: the same c_blocks at the
+ * same positions, the same statistics.  i_stage1() then only marks
+ * the old c_blocks, takes up the statistics and replays the
+ * callbacks, in order, before building fragments as usual.  Otherwise
+ * the new c_block's verified marks are cleared and stage 1 runs as
+ * if nothing had happened.  Stage 1 running ahead also gives up (and
+ * leaves it to stage 1 proper) if the statistics call for drift
+ * compensation, as that moves the whole cache.
+ */
+
+typedef struct c_stage1mark{
+  long old;            /* index into old[] */
+  long begin;          /* samples to mark verified, from cb(old) */
+  long end;
+} c_stage1mark;
+
+typedef struct c_stage1ahead{
+  cdrom_paranoia shadow; /* first, so that stage 1 can find the rest */
+
+  /* what stage 1 starts from */
+  offsets stage1;
+  offsets stage2;
+  long dynoverlap;
+  long dyndrift;
+  c_block **old;       /* the cache, oldest first, pinned... */
+  c_block *oldcopy;    /* ...and as it stood */
+  long oldcount;
+  long oldalloc;
+  c_block new;
+
+  /* what it did */
+  c_stage1mark *marks;
+  long markcount;
+  long markalloc;
+  c_readcb *cb;
+  long cbcount;
+  long cballoc;
+
+  int planned;
+  int ran;
+  c_block *adopt;      /* the c_block i_stage1() may take the result for */
+} c_stage1ahead;
+
+typedef struct c_readahead{
+  pthread_t thread;
+  int pending;         /* a span was started and not yet collected */
+  c_readspan plan;     /* the span as planned... */
+  c_readspan span;     /* ...and as read */
+  long words;          /* slab size the span's buffer came from */
+  cdrom_drive shadow;
+  c_stage1ahead stage1;
+} c_readahead;
+
+/* stage 1 on the read-ahead thread records its callbacks here */
+static __thread c_stage1ahead *stage1_recording;
+
+static void i_stage1_ahead_callback(long pos,int mode){
+  c_stage1ahead *s1=stage1_recording;
+  if(s1->cbcount>=s1->cballoc){
+    s1->cballoc=(s1->cballoc?s1->cballoc*2:64);
+    s1->cb=realloc(s1->cb,s1->cballoc*sizeof(*s1->cb));
+  }
+  s1->cb[s1->cbcount].pos=pos;
+  s1->cb[s1->cbcount].mode=mode;
+  s1->cbcount++;
+}
+
+/* called from stage1_matched() in place of marking old verified */
+static void i_stage1_ahead_mark(cdrom_paranoia *p,c_block *old,
+				long begin,long end){
+  c_stage1ahead *s1=(c_stage1ahead *)p;
+  if(begin>=end)return;
+  if(s1->markcount>=s1->markalloc){
+    s1->markalloc=(s1->markalloc?s1->markalloc*2:64);
+    s1->marks=realloc(s1->marks,s1->markalloc*sizeof(*s1->marks));
+  }
+  s1->marks[s1->markcount].old=old-s1->oldcopy;
+  s1->marks[s1->markcount].begin=begin;
+  s1->marks[s1->markcount].end=end;
+  s1->markcount++;
+}
+
+/* Take a snapshot of what stage 1 would start from, were the span
+   being planned read next. */
+static void i_stage1_ahead_plan(cdrom_paranoia *p,c_stage1ahead *s1){
+  sort_info *sortcache=s1->shadow.sortcache;
+  c_block *c;
+  long n=p->cache->active,k;
+  long cursor,trimto;
+
+  s1->planned=0;
+  s1->ran=0;
+  s1->adopt=NULL;
+  if(!(p->enable&PARANOIA_MODE_VERIFY))return;
+
+  if(sortcache && sortcache->maxsize!=p->sortcache->maxsize){
+    sort_free(sortcache);
+    sortcache=NULL;
+  }
+  if(sortcache==NULL){
+    sortcache=sort_alloc(p->sortcache->maxsize,SORT_FLAT);
+    sort_setwidth(sortcache,MIN_WORDS_KEY);
+  }
+
+  s1->shadow=*p;
+  s1->shadow.sortcache=sortcache;
+  s1->shadow.readahead=NULL;
+  s1->shadow.ahead=1;
+  s1->stage1=p->stage1;
+  s1->stage2=p->stage2;
+  s1->dynoverlap=p->dynoverlap;
+  s1->dyndrift=p->dyndrift;
+
+  /* The span is wanted once the cursor comes within
+     MAX_SECTOR_OVERLAP sectors of the end of the root.  By then,
+     i_paranoia_trim() will have let go of the c_blocks ending well
+     before the cursor, and once the new c_block joins the cache,
+     recover_cache() leaves room for cache_limit-1 of the rest. */
+  cursor=re(&p->root)/CD_FRAMEWORDS-MAX_SECTOR_OVERLAP;
+  if(cursor<p->cursor)cursor=p->cursor;
+  trimto=(cursor-MAX_SECTOR_OVERLAP)*CD_FRAMEWORDS;
+
+  if(n>s1->oldalloc){
+    s1->oldalloc=n;
+    s1->old=realloc(s1->old,n*sizeof(*s1->old));
+    s1->oldcopy=realloc(s1->oldcopy,n*sizeof(*s1->oldcopy));
+  }
+  n=0;
+  for(c=c_first(p);c && n<p->cache_limit-1;c=c_next(c))
+    if(ce(c)>=trimto)
+      s1->old[n++]=c;
+
+  /* oldest first, as stage 1 goes */
+  s1->oldcount=n;
+  for(k=0;k<n/2;k++){
+    c=s1->old[k];
+    s1->old[k]=s1->old[n-1-k];
+    s1->old[n-1-k]=c;
+  }
+  for(k=0;k<n;k++){
+    s1->oldcopy[k]=*s1->old[k];
+    s1->old[k]->pinned=1;
+  }
+
+  s1->markcount=0;
+  s1->cbcount=0;
+  s1->planned=1;
+}
+
+/* Run on the read-ahead thread, once the span is in */
+static void i_stage1_ahead(c_stage1ahead *s1,c_readspan *s){
+  cdrom_paranoia *p=&s1->shadow;
+  c_block *new=&s1->new;
+  long k;
+
+  memset(new,0,sizeof(*new));
+  new->vector=s->buffer;
+  new->flags=s->flags;
+  new->begin=s->firstread*CD_FRAMEWORDS-s1->dyndrift;
+  new->size=s->sofar*CD_FRAMEWORDS;
+  new->p=p;
+
+  stage1_recording=s1;
+  if(p->stage1pool){
+    c_block **old=i_stage1_olds(p->stage1pool,s1->oldcount);
+    for(k=0;k<s1->oldcount;k++)
+      old[k]=s1->oldcopy+k;
+    i_stage1_parallel(p,s1->oldcount,new,i_stage1_ahead_callback);
+  }else{
+    sort_setup(p->sortcache,cv(new),&cb(new),cs(new),cb(new),ce(new));
+    for(k=0;k<s1->oldcount && p->ahead==1;k++){
+      i_stage1_ahead_callback(cb(new),PARANOIA_CB_VERIFY);
+      i_iterate_stage1(p,s1->oldcopy+k,new,i_stage1_ahead_callback);
+    }
+  }
+  stage1_recording=NULL;
+  s1->ran=1;
+}
+
+/* Unpin the old c_blocks, freeing those the cache let go meanwhile */
+static void i_stage1_ahead_release(c_stage1ahead *s1){
+  long k;
+  if(!s1->planned)return;
+  for(k=0;k<s1->oldcount;k++){
+    c_block *c=s1->old[k];
+    if(c->pinned==2)
+      i_cblock_destructor(c);
+    else
+      c->pinned=0;
+  }
+  s1->oldcount=0;
+  s1->planned=0;
+}
+
+/* The span read ahead became (new).  Would stage 1 proper start from
+   where stage 1 ahead did?  If not, undo what it did to (new). */
+static void i_stage1_ahead_check(cdrom_paranoia *p,c_stage1ahead *s1,
+				 c_block *new){
+  int ok=(s1->planned && s1->ran && s1->shadow.ahead==1 &&
+	  (p->enable&PARANOIA_MODE_VERIFY) &&
+	  cb(new)==s1->new.begin && cs(new)==s1->new.size &&
+	  p->dynoverlap==s1->dynoverlap && p->dyndrift==s1->dyndrift &&
+	  !memcmp(&p->stage1,&s1->stage1,sizeof(p->stage1)) &&
+	  !memcmp(&p->stage2,&s1->stage2,sizeof(p->stage2)));
+
+  if(ok){
+    c_block *c=c_last(p);
+    long k;
+    for(k=0;k<s1->oldcount && c;k++,c=c_prev(c))
+      if(c!=s1->old[k] || cb(c)!=s1->oldcopy[k].begin ||
+	 cs(c)!=s1->oldcopy[k].size)break;
+    ok=(k==s1->oldcount && c==new);
+  }
+
+  if(ok)
+    s1->adopt=new;
+  else if(s1->ran){
+    long i;
+    for(i=0;i<cs(new);i++)
+      new->flags[i]&=~FLAGS_VERIFIED;
+  }
+  i_stage1_ahead_release(s1);
+}
+
+/* Called by i_stage1(): if stage 1 already ran ahead on (new), take
+   up its results and return 1. */
+static int i_stage1_ahead_adopt(cdrom_paranoia *p,c_block *new,
+				void(*callback)(long,int)){
+  c_stage1ahead *s1;
+  long i,j;
+
+  if(p->readahead==NULL)return(0);
+  s1=&p->readahead->stage1;
+  if(s1->adopt!=new)return(0);
+  s1->adopt=NULL;
+
+  for(i=0;i<s1->markcount;i++){
+    c_stage1mark *m=s1->marks+i;
+    unsigned char *flags=s1->old[m->old]->flags;
+    for(j=m->begin;j<m->end;j++)
+      flags[j]|=FLAGS_VERIFIED;
+  }
+
+  p->stage1=s1->shadow.stage1;
+  p->stage2=s1->shadow.stage2;
+  p->dynoverlap=s1->shadow.dynoverlap;
+
+  if(callback)
+    for(i=0;i<s1->cbcount;i++)
+      (*callback)(s1->cb[i].pos,s1->cb[i].mode);
+  return(1);
+}
+
+static void i_stage1_ahead_free(c_stage1ahead *s1){
+  i_stage1_ahead_release(s1);
+  if(s1->shadow.sortcache)sort_free(s1->shadow.sortcache);
+  if(s1->old)free(s1->old);
+  if(s1->oldcopy)free(s1->oldcopy);
+  if(s1->marks)free(s1->marks);
+  if(s1->cb)free(s1->cb);
+}
+
+/* Given the root as it stands, the first sector i_read_c_block() would
+   read, were its jiggle (jitter) */
+static long i_read_target(cdrom_paranoia *p,long beginword,int jitter){
+  long driftcomp=(float)p->dyndrift/CD_FRAMEWORDS+.5;
+  long dynoverlap=(p->dynoverlap+CD_FRAMEWORDS-1)/CD_FRAMEWORDS; 
+  root_block *root=&p->root;
+  long readat;
+
+  /* What is the first sector to read?  want some pre-buffer if
+     we're not at the extreme beginning of the disc */
+  
+  if(p->enable&(PARANOIA_MODE_VERIFY|PARANOIA_MODE_OVERLAP)){
+    
+    long target;
+    if(rv(root)==NULL || rb(root)>beginword)
+      target=p->cursor-dynoverlap; 
+    else
+      target=re(root)/(CD_FRAMEWORDS)-dynoverlap;
+	
+    /* we want to jitter the read alignment boundary, as some
+       drives, beginning from a specific point, will tend to
+       lose bytes between sectors in the same place.  Also, as
+       our vectors are being made up of multiple reads, we want
+       the overlap boundaries to move.... */
+    
+    readat=(target&(~((long)JIGGLE_MODULO-1)))+jitter;
+    if(readat>target)readat-=JIGGLE_MODULO;
+     
+  }else{
+    readat=p->cursor; 
+  }
+  
+  return(readat+driftcomp);
+}
+
+static void *i_readahead_thread(void *arg){
+  c_readahead *ra=arg;
+  i_read_span(&ra->span);
+  if(ra->stage1.planned && ra->span.anyflag && ra->span.err!=ENOMEDIUM)
+    i_stage1_ahead(&ra->stage1,&ra->span);
+  return(NULL);
+}
+
+static char *i_catstring(char *buff,char *s){
+  if(s){
+    if(buff){
+      buff=realloc(buff,strlen(buff)+strlen(s)+1);
+      strcat(buff,s);
+    }else
+      buff=strdup(s);
+  }
+  return(buff);
+}
+
+/* Start reading ahead the span that the next read should want. */
+static void i_readahead_start(cdrom_paranoia *p){
+  c_readahead *ra=p->readahead;
+  root_block *root=&p->root;
+  c_readspan *s;
+
+  if(ra==NULL || ra->pending)return;
+  if(!(p->enable&(PARANOIA_MODE_VERIFY|PARANOIA_MODE_OVERLAP)))return;
+  if(rv(root)==NULL || root->lastsector)return;
+
+  s=&ra->span;
+  i_span_init(p,s,i_read_target(p,p->cursor*CD_FRAMEWORDS,p->jitter));
+  if(s->readat>s->lastsector)return;
+
+  s->buffer=c_slab_get(p,&s->flags);
+  if(s->buffer==NULL)return;
+  memset(s->flags,0,s->totaltoread*CD_FRAMEWORDS);
+  ra->words=p->pool.words;
+  ra->plan=*s;
+
+  ra->shadow=*p->d;
+  ra->shadow.errorbuf=NULL;
+  ra->shadow.messagebuf=NULL;
+  s->d=&ra->shadow;
+  s->deferred=1;
+
+  i_stage1_ahead_plan(p,&ra->stage1);
+
+  if(pthread_create(&ra->thread,NULL,i_readahead_thread,ra)){
+    i_stage1_ahead_release(&ra->stage1);
+    c_slab_put(p,s->buffer,ra->words);
+    return;
+  }
+  ra->pending=1;
+}
+
+/* Wait for the read-ahead to finish and hand back what it changed:
+   the drive state and its messages, the cache model, and (if there
+   is anyone to hear them) its callbacks.  The span itself is left for
+   the caller to use or give back. */
+static void i_readahead_finish(cdrom_paranoia *p,void(*callback)(long,int)){
+  c_readahead *ra=p->readahead;
+  c_readspan *s=&ra->span;
+  cdrom_drive *d=p->d;
+  long i;
+
+  pthread_join(ra->thread,NULL);
+  ra->pending=0;
+
+  /* only what a read can change comes back; the caller may have
+     retargeted messages or the like since the copy was taken */
+  d->nsectors=ra->shadow.nsectors;
+  d->bigbuff=ra->shadow.bigbuff;
+  d->bigendianp=ra->shadow.bigendianp;
+  d->fua=ra->shadow.fua;
+  d->errorbuf=i_catstring(d->errorbuf,ra->shadow.errorbuf);
+  d->messagebuf=i_catstring(d->messagebuf,ra->shadow.messagebuf);
+  if(ra->shadow.errorbuf)free(ra->shadow.errorbuf);
+  if(ra->shadow.messagebuf)free(ra->shadow.messagebuf);
+
+  p->cdcache_begin=s->cdcache_begin;
+  p->cdcache_end=s->cdcache_end;
+
+  if(callback)
+    for(i=0;i<s->cbcount;i++)
+      (*callback)(s->cb[i].pos,s->cb[i].mode);
+  if(s->cb)free(s->cb);
+  s->cb=NULL;
+}
+
+/* Throw away any read-ahead in progress */
+static void i_readahead_cancel(cdrom_paranoia *p){
+  c_readahead *ra=p->readahead;
+  if(ra && ra->pending){
+    i_readahead_finish(p,NULL);
+    i_stage1_ahead_release(&ra->stage1);
+    c_slab_put(p,ra->span.buffer,ra->words);
+  }
+}
 
 /* ===========================================================================
  * read_c_block() (internal)
  *
- * This funtion reads many (p->readahead) sectors, encompassing at least
+ * This funtion reads many (p->cdcache_size) sectors, encompassing at least
  * the requested words.
  *
  * It returns a c_block which encapsulates these sectors' data and sector
@@ -2318,18 +3477,9 @@ c_block *i_read_c_block(cdrom_paranoia *p,long beginword,long endword,
    to try to break borderline drives more noticeably (and make broken
    drives with unaddressable sectors behave more often). */
       
-  long readat,firstread;
-  long totaltoread=p->cdcache_size;
-  long sectatonce=p->d->nsectors;
-  long driftcomp=(float)p->dyndrift/CD_FRAMEWORDS+.5;
   c_block *new=NULL;
-  root_block *root=&p->root;
-  int16_t *buffer=NULL;
-  unsigned char *flags=NULL;
-  long sofar;
-  long dynoverlap=(p->dynoverlap+CD_FRAMEWORDS-1)/CD_FRAMEWORDS; 
-  long anyflag=0;
-
+  c_readspan span;
+  int ahead=0;
 
   /* Calculate the first sector to read.  This calculation takes
    * into account the need to jitter the starting point of the read
@@ -2337,40 +3487,17 @@ c_block *i_read_c_block(cdrom_paranoia *p,long beginword,long endword,
    * the edge words of a read.
    */
 
-  /* What is the first sector to read?  want some pre-buffer if
-     we're not at the extreme beginning of the disc */
-  
+  i_span_init(p,&span,i_read_target(p,beginword,p->jitter));
   if(p->enable&(PARANOIA_MODE_VERIFY|PARANOIA_MODE_OVERLAP)){
-    
-    long target;
-    if(rv(root)==NULL || rb(root)>beginword)
-      target=p->cursor-dynoverlap; 
-    else
-      target=re(root)/(CD_FRAMEWORDS)-dynoverlap;
-	
-    /* we want to jitter the read alignment boundary, as some
-       drives, beginning from a specific point, will tend to
-       lose bytes between sectors in the same place.  Also, as
-       our vectors are being made up of multiple reads, we want
-       the overlap boundaries to move.... */
-    
-    readat=(target&(~((long)JIGGLE_MODULO-1)))+p->jitter;
-    if(readat>target)readat-=JIGGLE_MODULO;
     p->jitter--;
     if(p->jitter<0)p->jitter+=JIGGLE_MODULO;
-     
-  }else{
-    readat=p->cursor; 
   }
   
-  readat+=driftcomp;
-  
   /* Create a new, empty c_block and add it to the head of the
    * list of c_blocks in memory.  It will be empty until the end of
    * this subroutine.
    */
   if(p->enable&(PARANOIA_MODE_OVERLAP|PARANOIA_MODE_VERIFY)){
-    flags=calloc(totaltoread*CD_FRAMEWORDS,1);
     new=new_c_block(p);
     recover_cache(p);
   }else{
@@ -2379,150 +3506,97 @@ c_block *i_read_c_block(cdrom_paranoia *p,long beginword,long endword,
     new=new_c_block(p);
   }
 
-  buffer=malloc(totaltoread*CD_FRAMESIZE_RAW);
-  sofar=0;
-  firstread=-1;
-  
-  /* we have a read span; flush the drive cache if needed */
-  cdrom_cache_handler(p, readat, callback);
-
-  /* Issue each of the low-level reads; the optimal read size is
-   * approximately the cachemodel's cdrom cache size.  The only reason
-   * to read less would be memory considerations.
-   *
-   * p->readahead   = total number of sectors to read
-   * p->d->nsectors = number of sectors to read per request
-   */
-
-  /* actual read loop */
+  /* Did we already read this span ahead? */
+  if(p->readahead && p->readahead->pending){
+    c_readahead *ra=p->readahead;
+    int same=(i_span_same(&ra->plan,&span) && ra->words==p->pool.words &&
+	      (p->enable&(PARANOIA_MODE_OVERLAP|PARANOIA_MODE_VERIFY)));
 
-  while(sofar<totaltoread){
-    long secread=sectatonce;  /* number of sectors to read this request */
-    long adjread=readat;      /* first sector to read for this request */
-    long thisread;            /* how many sectors were read this request */
+    i_readahead_finish(p,same?callback:NULL);
+    if(same){
+      span=ra->span;
+      ahead=1;
+    }else{
+      i_stage1_ahead_release(&ra->stage1);
+      c_slab_put(p,ra->span.buffer,ra->words);
 
-    /* don't under/overflow the audio session */
-    if(adjread<p->current_firstsector){
-      secread-=p->current_firstsector-adjread;
-      adjread=p->current_firstsector;
+      /* the cache model has moved on */
+      i_span_init(p,&span,span.readat);
     }
-    if(adjread+secread-1>p->current_lastsector)
-      secread=p->current_lastsector-adjread+1;
-    
-    if(sofar+secread>totaltoread)secread=totaltoread-sofar;
-    
-    if(secread>0){
-      
-      if(firstread<0)firstread=adjread;
-
-      /* Issue the low-level read to the driver.
-       */
-
-      /* If the low-level read returned too few sectors, pad the result
-       * with null data and mark it as invalid (FLAGS_UNREAD).  We pad
-       * because we're going to be appending further reads to the current
-       * c_block.
-       *
-       * "???: Why not re-read?  It might be to keep you from getting
-       * hung up on a bad sector.  Or it might be to avoid
-       * interrupting the streaming as much as possible."  
-       *
-       * There are drives on which you will never get a full read in
-       * some positions.  They always abort out early due to firmware
-       * boundary cases.  Reread will cause exactly the same thing to
-       * happen again.  NEC MultiSpeed 4x is one such drive. In these
-       * cases, you take what part of the read you know is good, and
-       * you get substantially better performance. --Monty
-       */
-
-      if((thisread=cdda_read(p->d,buffer+sofar*CD_FRAMEWORDS,adjread,
-			    secread))<secread){
+  }
 
-	if(thisread<0){
-	  if(errno==ENOMEDIUM){
-	    /* the one error we bail on immediately */
-	    if(new)free_c_block(new);
-	    if(buffer)free(buffer);
-	    if(flags)free(flags);
-	    return NULL;
-	  }
-	  thisread=0;
-	}
+  if(!ahead){
+    /* The vector and flags come from the pool, after recover_cache()
+     * has had a chance to return a culled c_block's slab to it.
+     */
+    span.buffer=c_slab_get(p,&span.flags);
+    if(span.buffer==NULL){
+      free_c_block(new);
+      return NULL;
+    }
+    if(p->enable&(PARANOIA_MODE_OVERLAP|PARANOIA_MODE_VERIFY))
+      memset(span.flags,0,span.totaltoread*CD_FRAMEWORDS);
+    else
+      span.flags=NULL;
+    span.callback=callback;
 
-	/* Uhhh... right.  Make something up. But don't make us seek
-           backward! */
+    i_read_span(&span);
+    p->cdcache_begin=span.cdcache_begin;
+    p->cdcache_end=span.cdcache_end;
+  }
 
-	if(callback)(*callback)((adjread+thisread)*CD_FRAMEWORDS,PARANOIA_CB_READERR);  
-	memset(buffer+(sofar+thisread)*CD_FRAMEWORDS,0,
-	       CD_FRAMESIZE_RAW*(secread-thisread));
-	if(flags)memset(flags+(sofar+thisread)*CD_FRAMEWORDS,FLAGS_UNREAD,
-	       CD_FRAMEWORDS*(secread-thisread));
-      }
-      if(thisread!=0)anyflag=1;
-      
+  if(ahead && (span.err==ENOMEDIUM || !span.anyflag))
+    i_stage1_ahead_release(&p->readahead->stage1);
 
-      /* Because samples are likely to be dropped between read requests,
-       * mark the samples near the the boundaries of the read requests
-       * as suspicious (FLAGS_EDGE).  This means that any span of samples
-       * against which these adjacent read requests are compared must
-       * overlap beyond the edges and into the more trustworthy data.
-       * Such overlapping spans are accordingly at least MIN_WORDS_OVERLAP
-       * words long (and naturally longer if any samples were dropped
-       * between the read requests).
-       *
-       *          (EEEEE...overlapping span...EEEEE)
-       * (read 1 ...........EEEEE)   (EEEEE...... read 2 ......EEEEE) ...
-       *         dropped samples --^
-       */
-      if(flags && sofar!=0){
-	/* Don't verify across overlaps that are too close to one
-           another */
-	int i=0;
-	for(i=-MIN_WORDS_OVERLAP/2;i<MIN_WORDS_OVERLAP/2;i++)
-	  flags[sofar*CD_FRAMEWORDS+i]|=FLAGS_EDGE;
-      }
+  if(span.err!=ENOMEDIUM)
+    i_readsize_update(p,&span);
 
-      if(adjread+secread-1==p->current_lastsector)
-	new->lastsector=-1;
-      
-      if(callback)(*callback)((adjread+secread-1)*CD_FRAMEWORDS,PARANOIA_CB_READ);
-      
-      cdrom_cache_update(p,adjread,secread);
-      sofar+=secread;
-      readat=adjread+secread; 
-    }else /* secread <= 0 */
-      if(readat<p->current_firstsector)
-	readat+=sectatonce; /* due to being before the readable area */
-      else
-	break; /* due to being past the readable area */
-    
-    
-    /* Keep issuing read requests until we've read enough sectors to
-     * exhaust the drive's cache.
-     */
-    
-  } /* end while */
+  if(span.err==ENOMEDIUM){
+    free_c_block(new);
+    c_slab_put(p,span.buffer,p->pool.words);
+    errno=ENOMEDIUM;
+    return NULL;
+  }
 
+  if(span.lastread)
+    new->lastsector=-1;
 
   /* If we managed to read any sectors at all (anyflag), fill in the
    * previously allocated c_block with the read data.  Otherwise, free
    * our buffers, dispose of the c_block, and return NULL.
    */
-  if(anyflag){
-    new->vector=buffer;
-    new->begin=firstread*CD_FRAMEWORDS-p->dyndrift;
-    new->size=sofar*CD_FRAMEWORDS;
-    new->flags=flags;
+  if(span.anyflag){
+    new->vector=span.buffer;
+    new->begin=span.firstread*CD_FRAMEWORDS-p->dyndrift;
+    new->size=span.sofar*CD_FRAMEWORDS;
+    new->flags=span.flags;
+    new->slab=p->pool.words;
+
+    /* ...and did stage 1 run ahead on it to any purpose? */
+    if(ahead)i_stage1_ahead_check(p,&p->readahead->stage1,new);
   }else{
-    if(new)free_c_block(new);
-    free(buffer);
-    free(flags);
+    free_c_block(new);
+    c_slab_put(p,span.buffer,p->pool.words);
     new=NULL;
   }
   return(new);
 }
 
 
+/* Can paranoia_read_limited() return the words from (beginword) to
+   (endword) straight from the root? */
+static int i_root_holds(cdrom_paranoia *p,long beginword,long endword){
+  root_block *root=&p->root;
+
+  if(rv(root)==NULL || rb(root)>beginword || re(root)<endword)return(0);
+
+  /* when verifying, keep enough ahead to verify what comes next
+     against */
+  if(p->enable&(PARANOIA_MODE_VERIFY|PARANOIA_MODE_OVERLAP))
+    if(re(root)<endword+(MAX_SECTOR_OVERLAP*CD_FRAMEWORDS))return(0);
+  return(1);
+}
+
 /** ==========================================================================
  * paranoia_read(), paranoia_read_limited()
  *
@@ -2567,11 +3641,7 @@ int16_t *paranoia_read_limited(cdrom_paranoia *p, void(*callback)(long,int),
    */
   
   /* First, is the sector we want already in the root? */
-  while(rv(root)==NULL ||
-	rb(root)>beginword || 
-	(re(root)<endword+(MAX_SECTOR_OVERLAP*CD_FRAMEWORDS) &&
-	 p->enable&(PARANOIA_MODE_VERIFY|PARANOIA_MODE_OVERLAP)) ||
-	re(root)<endword){
+  while(!i_root_holds(p,beginword,endword)){
     
     /* Nope; we need to build or extend the root verified range */
 
@@ -2733,12 +3803,102 @@ int16_t *paranoia_read_limited(cdrom_paranoia *p, void(*callback)(long,int),
   } /* end while */
   p->cursor++;
 
+  /* Get the drive started on the next read while the caller works
+   * through what we have.
+   */
+  i_readahead_start(p);
+
   /* Return a pointer into the verified root.  Thus, the caller
    * must NOT free the returned pointer!
    */
   return(rv(root)+(beginword-rb(root)));
 }
 
+/** ==========================================================================
+ * paranoia_read_span()
+ *
+ * Like paranoia_read_limited(), but once the sector at the cursor is
+ * verified, it goes on to return the sectors after it that are already
+ * in the root as well, up to (maxsectors) in all.  (*sectors) is set to
+ * the number returned.  They follow one another in the returned
+ * buffer, which like that of paranoia_read() belongs to the library and
+ * persists only until the next call.
+ *
+ * The sectors returned and the reads made are the same as calling
+ * paranoia_read_limited() (*sectors) times would give.
+ */
+int16_t *paranoia_read_span(cdrom_paranoia *p,void(*callback)(long,int),
+			    int max_retries,long maxsectors,long *sectors){
+  int16_t *ret=paranoia_read_limited(p,callback,max_retries);
+  root_block *root=&p->root;
+  long n=1;
+
+  if(ret==NULL){
+    if(sectors)*sectors=0;
+    return NULL;
+  }
+
+  while(n<maxsectors){
+    long beginword=p->cursor*(CD_FRAMEWORDS);
+
+    if(!i_root_holds(p,beginword,beginword+CD_FRAMEWORDS))break;
+    if(beginword>root->returnedlimit)root->returnedlimit=beginword;
+    p->cursor++;
+    n++;
+  }
+
+  if(sectors)*sectors=n;
+  return(ret);
+}
+
+/* enable<0 is a query.  Returns whether read-ahead was enabled before
+   the call */
+int paranoia_readahead(cdrom_paranoia *p,int enable){
+  int ret=(p->readahead!=NULL);
+
+  if(enable>0 && !p->readahead)
+    p->readahead=calloc(1,sizeof(*p->readahead));
+  if(enable==0 && p->readahead){
+    i_readahead_cancel(p);
+    i_stage1_ahead_free(&p->readahead->stage1);
+    free(p->readahead);
+    p->readahead=NULL;
+  }
+  return(ret);
+}
+
+/* threads<0 is a query.  Returns the number of threads stage 1 ran on
+   before the call */
+int paranoia_threads(cdrom_paranoia *p,int threads){
+  int ret=(p->stage1pool?p->stage1pool->threads:1);
+
+  if(threads>=0 && threads!=ret){
+    /* a read-ahead may be running stage 1 with the old pool */
+    i_readahead_cancel(p);
+    if(p->stage1pool)i_stage1_pool_free(p->stage1pool);
+    p->stage1pool=NULL;
+    if(threads>1)p->stage1pool=i_stage1_pool_new(threads);
+  }
+  return(ret);
+}
+
+/* enable<0 is a query.  Returns whether the read size adapted to the
+   drive before the call */
+int paranoia_adaptive_reads(cdrom_paranoia *p,int enable){
+  c_readsize *r=&p->readsize;
+  int ret=r->enabled;
+
+  if(enable>0 && !r->enabled){
+    memset(r,0,sizeof(*r));
+    r->enabled=1;
+    r->size=r->base=r->max=p->d->nsectors;
+    r->dir=1;
+  }
+  if(enable==0)
+    r->enabled=0;
+  return(ret);
+}
+
 /* a temporary hack */
 void paranoia_overlapset(cdrom_paranoia *p, long overlap){
   p->dynoverlap=overlap*CD_FRAMEWORDS;
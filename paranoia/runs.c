@@ -0,0 +1,700 @@
+/***
+ * CopyPolicy: GNU Lesser General Public License 2.1 applies
+ * Copyright (C) by Monty (xiphmont@mit.edu)
+ *
+ * Run extension primitives for paranoia
+ *
+ ***/
+
+/* Nearly all of the time paranoia spends comparing samples is spent
+ * asking "how far do these two vectors keep agreeing?", one sample
+ * at a time.  The primitives here answer that question several samples
+ * per step where the processor can: 8 at a time with SSE2, 16 with
+ * AVX2.  Which version to use is decided at run time, the first time
+ * one is called; the plain C versions are used everywhere else, and
+ * define what the others must return.
+ *
+ * The flag variants stop at the first sample whose flags would end a
+ * run, as well as at the first mismatch.  They don't try to decide
+ * whether such a sample really does end the run (that depends on the
+ * caller's rules); they only skip the samples that certainly don't.
+ *
+ * The find and sync variants turn the question around for rift
+ * analysis: given a short run of samples, at which of many shifts does
+ * the other vector agree with all of it (find), or where do the two
+ * vectors next agree for a whole run (sync)?  Every position in a step
+ * is screened at once by comparing the run's first and last samples,
+ * and only the positions that pass both are compared in full.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "p_block.h"
+#include "runs.h"
+
+#if defined(__GNUC__) && (__GNUC__>=5 || defined(__clang__)) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define RUNS_X86
+#include <immintrin.h>
+#endif
+
+/**** Plain C ************************************************************/
+
+static long run_f_c(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[j]!=B[j])break;
+  return(j);
+}
+
+static long run_r_c(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[-j]!=B[-j])break;
+  return(j);
+}
+
+static long run_flags_f_c(int16_t *A,int16_t *B,
+			  unsigned char *flagsA,unsigned char *flagsB,
+			  long n,int both,int either){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[j]!=B[j] || (flagsA[j]&flagsB[j]&both) ||
+       ((flagsA[j]|flagsB[j])&either))break;
+  return(j);
+}
+
+static long run_flags_r_c(int16_t *A,int16_t *B,
+			  unsigned char *flagsA,unsigned char *flagsB,
+			  long n,int both,int either){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[-j]!=B[-j] || (flagsA[-j]&flagsB[-j]&both) ||
+       ((flagsA[-j]|flagsB[-j])&either))break;
+  return(j);
+}
+
+static long run_find_f_c(int16_t *P,int16_t *T,long n,long len){
+  long j;
+  for(j=0;j<n;j++)
+    if(T[j]==P[0] && !memcmp(T+j,P,len*sizeof(*P)))return(j);
+  return(-1);
+}
+
+static long run_find_r_c(int16_t *P,int16_t *T,long n,long len){
+  long j;
+  for(j=0;j<n;j++)
+    if(T[-j]==P[0] && !memcmp(T-j-len+1,P-len+1,len*sizeof(*P)))return(j);
+  return(-1);
+}
+
+static long run_sync_f_c(int16_t *A,int16_t *B,long n,long len){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[j]==B[j] && !memcmp(A+j,B+j,len*sizeof(*A)))return(j);
+  return(-1);
+}
+
+static long run_sync_r_c(int16_t *A,int16_t *B,long n,long len){
+  long j;
+  for(j=0;j<n;j++)
+    if(A[-j]==B[-j] && !memcmp(A-j-len+1,B-j-len+1,len*sizeof(*A)))
+      return(j);
+  return(-1);
+}
+
+#ifdef RUNS_X86
+
+/**** SSE2 ***************************************************************/
+
+/* Each compare gives a 16 bit movemask with two bits per sample.  Going
+ * forward, the first mismatch is the lowest clear bit; going backward,
+ * the vector ends at the current sample, so it's the highest.
+ */
+
+__attribute__((target("sse2")))
+static long run_f_sse2(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A+j));
+    __m128i b=_mm_loadu_si128((__m128i *)(B+j));
+    unsigned m=_mm_movemask_epi8(_mm_cmpeq_epi16(a,b))^0xffff;
+    if(m)return(j+(__builtin_ctz(m)>>1));
+  }
+  return(j+run_f_c(A+j,B+j,n-j));
+}
+
+__attribute__((target("sse2")))
+static long run_r_sse2(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A-j-7));
+    __m128i b=_mm_loadu_si128((__m128i *)(B-j-7));
+    unsigned m=_mm_movemask_epi8(_mm_cmpeq_epi16(a,b))^0xffff;
+    if(m)return(j+7-((31-__builtin_clz(m))>>1));
+  }
+  return(j+run_r_c(A-j,B-j,n-j));
+}
+
+/* The sample compare is narrowed to one byte per sample with a
+ * saturating pack (0xffff stays all ones, 0 stays 0), so it can be
+ * combined with the flag bytes directly.
+ */
+
+__attribute__((target("sse2")))
+static inline unsigned run_mask_sse2(__m128i eq8,__m128i fa,__m128i fb,
+				     __m128i both,__m128i either){
+  __m128i stop=_mm_or_si128(_mm_and_si128(_mm_and_si128(fa,fb),both),
+			    _mm_and_si128(_mm_or_si128(fa,fb),either));
+  __m128i ok=_mm_and_si128(eq8,_mm_cmpeq_epi8(stop,_mm_setzero_si128()));
+  return(_mm_movemask_epi8(ok));
+}
+
+__attribute__((target("sse2")))
+static long run_flags_f_sse2(int16_t *A,int16_t *B,
+			     unsigned char *flagsA,unsigned char *flagsB,
+			     long n,int both,int either){
+  __m128i vboth=_mm_set1_epi8(both);
+  __m128i veither=_mm_set1_epi8(either);
+  long j;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A+j));
+    __m128i b=_mm_loadu_si128((__m128i *)(B+j));
+    __m128i eq=_mm_cmpeq_epi16(a,b);
+    __m128i fa=_mm_loadl_epi64((__m128i *)(flagsA+j));
+    __m128i fb=_mm_loadl_epi64((__m128i *)(flagsB+j));
+    unsigned m=run_mask_sse2(_mm_packs_epi16(eq,eq),fa,fb,vboth,veither);
+    m=(m&0xff)^0xff;
+    if(m)return(j+__builtin_ctz(m));
+  }
+  return(j+run_flags_f_c(A+j,B+j,flagsA+j,flagsB+j,n-j,both,either));
+}
+
+__attribute__((target("sse2")))
+static long run_flags_r_sse2(int16_t *A,int16_t *B,
+			     unsigned char *flagsA,unsigned char *flagsB,
+			     long n,int both,int either){
+  __m128i vboth=_mm_set1_epi8(both);
+  __m128i veither=_mm_set1_epi8(either);
+  long j;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A-j-7));
+    __m128i b=_mm_loadu_si128((__m128i *)(B-j-7));
+    __m128i eq=_mm_cmpeq_epi16(a,b);
+    __m128i fa=_mm_loadl_epi64((__m128i *)(flagsA-j-7));
+    __m128i fb=_mm_loadl_epi64((__m128i *)(flagsB-j-7));
+    unsigned m=run_mask_sse2(_mm_packs_epi16(eq,eq),fa,fb,vboth,veither);
+    m=(m&0xff)^0xff;
+    if(m)return(j+7-(31-__builtin_clz(m)));
+  }
+  return(j+run_flags_r_c(A-j,B-j,flagsA-j,flagsB-j,n-j,both,either));
+}
+
+/* Find: the lanes passing the first/last screen are verified in order
+ * of increasing shift, clearing both of a lane's mask bits each time.
+ */
+
+__attribute__((target("sse2")))
+static long run_find_f_sse2(int16_t *P,int16_t *T,long n,long len){
+  __m128i first=_mm_set1_epi16(P[0]);
+  __m128i last=_mm_set1_epi16(P[len-1]);
+  long j,ret;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(T+j));
+    __m128i b=_mm_loadu_si128((__m128i *)(T+j+len-1));
+    unsigned m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a,first),
+					       _mm_cmpeq_epi16(b,last)));
+    while(m){
+      long k=j+(__builtin_ctz(m)>>1);
+      if(!memcmp(T+k,P,len*sizeof(*P)))return(k);
+      m&=~(3U<<(__builtin_ctz(m)&~1));
+    }
+  }
+  ret=run_find_f_c(P,T+j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("sse2")))
+static long run_find_r_sse2(int16_t *P,int16_t *T,long n,long len){
+  __m128i first=_mm_set1_epi16(P[0]);
+  __m128i last=_mm_set1_epi16(P[1-len]);
+  long j,ret;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(T-j-7));
+    __m128i b=_mm_loadu_si128((__m128i *)(T-j-7-len+1));
+    unsigned m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a,first),
+					       _mm_cmpeq_epi16(b,last)));
+    while(m){
+      int bit=31-__builtin_clz(m);
+      long k=j+7-(bit>>1);
+      if(!memcmp(T-k-len+1,P-len+1,len*sizeof(*P)))return(k);
+      m&=~(3U<<(bit&~1));
+    }
+  }
+  ret=run_find_r_c(P,T-j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("sse2")))
+static long run_sync_f_sse2(int16_t *A,int16_t *B,long n,long len){
+  long j,ret;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A+j));
+    __m128i b=_mm_loadu_si128((__m128i *)(B+j));
+    __m128i c=_mm_loadu_si128((__m128i *)(A+j+len-1));
+    __m128i d=_mm_loadu_si128((__m128i *)(B+j+len-1));
+    unsigned m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a,b),
+					       _mm_cmpeq_epi16(c,d)));
+    while(m){
+      long k=j+(__builtin_ctz(m)>>1);
+      if(!memcmp(A+k,B+k,len*sizeof(*A)))return(k);
+      m&=~(3U<<(__builtin_ctz(m)&~1));
+    }
+  }
+  ret=run_sync_f_c(A+j,B+j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("sse2")))
+static long run_sync_r_sse2(int16_t *A,int16_t *B,long n,long len){
+  long j,ret;
+  for(j=0;j+8<=n;j+=8){
+    __m128i a=_mm_loadu_si128((__m128i *)(A-j-7));
+    __m128i b=_mm_loadu_si128((__m128i *)(B-j-7));
+    __m128i c=_mm_loadu_si128((__m128i *)(A-j-7-len+1));
+    __m128i d=_mm_loadu_si128((__m128i *)(B-j-7-len+1));
+    unsigned m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a,b),
+					       _mm_cmpeq_epi16(c,d)));
+    while(m){
+      int bit=31-__builtin_clz(m);
+      long k=j+7-(bit>>1);
+      if(!memcmp(A-k-len+1,B-k-len+1,len*sizeof(*A)))return(k);
+      m&=~(3U<<(bit&~1));
+    }
+  }
+  ret=run_sync_r_c(A-j,B-j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+/**** AVX2 ***************************************************************/
+
+/* As SSE2, 16 samples per step.  The sample movemask is 32 bits, still
+ * two per sample; the flag variants pack the two 128 bit halves of the
+ * compare down to 16 bytes, one per sample, to line up with the flags.
+ */
+
+__attribute__((target("avx2")))
+static long run_f_avx2(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(A+j));
+    __m256i b=_mm256_loadu_si256((__m256i *)(B+j));
+    unsigned m=~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(a,b));
+    if(m)return(j+(__builtin_ctz(m)>>1));
+  }
+  return(j+run_f_c(A+j,B+j,n-j));
+}
+
+__attribute__((target("avx2")))
+static long run_r_avx2(int16_t *A,int16_t *B,long n){
+  long j;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(A-j-15));
+    __m256i b=_mm256_loadu_si256((__m256i *)(B-j-15));
+    unsigned m=~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(a,b));
+    if(m)return(j+15-((31-__builtin_clz(m))>>1));
+  }
+  return(j+run_r_c(A-j,B-j,n-j));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i run_eq8_avx2(int16_t *A,int16_t *B){
+  __m256i a=_mm256_loadu_si256((__m256i *)A);
+  __m256i b=_mm256_loadu_si256((__m256i *)B);
+  __m256i eq=_mm256_cmpeq_epi16(a,b);
+  return(_mm_packs_epi16(_mm256_castsi256_si128(eq),
+			 _mm256_extracti128_si256(eq,1)));
+}
+
+__attribute__((target("avx2")))
+static long run_flags_f_avx2(int16_t *A,int16_t *B,
+			     unsigned char *flagsA,unsigned char *flagsB,
+			     long n,int both,int either){
+  __m128i vboth=_mm_set1_epi8(both);
+  __m128i veither=_mm_set1_epi8(either);
+  long j;
+  for(j=0;j+16<=n;j+=16){
+    __m128i fa=_mm_loadu_si128((__m128i *)(flagsA+j));
+    __m128i fb=_mm_loadu_si128((__m128i *)(flagsB+j));
+    unsigned m=run_mask_sse2(run_eq8_avx2(A+j,B+j),fa,fb,vboth,veither);
+    m^=0xffff;
+    if(m)return(j+__builtin_ctz(m));
+  }
+  return(j+run_flags_f_c(A+j,B+j,flagsA+j,flagsB+j,n-j,both,either));
+}
+
+__attribute__((target("avx2")))
+static long run_flags_r_avx2(int16_t *A,int16_t *B,
+			     unsigned char *flagsA,unsigned char *flagsB,
+			     long n,int both,int either){
+  __m128i vboth=_mm_set1_epi8(both);
+  __m128i veither=_mm_set1_epi8(either);
+  long j;
+  for(j=0;j+16<=n;j+=16){
+    __m128i fa=_mm_loadu_si128((__m128i *)(flagsA-j-15));
+    __m128i fb=_mm_loadu_si128((__m128i *)(flagsB-j-15));
+    unsigned m=run_mask_sse2(run_eq8_avx2(A-j-15,B-j-15),fa,fb,
+			     vboth,veither);
+    m^=0xffff;
+    if(m)return(j+15-(31-__builtin_clz(m)));
+  }
+  return(j+run_flags_r_c(A-j,B-j,flagsA-j,flagsB-j,n-j,both,either));
+}
+
+__attribute__((target("avx2")))
+static long run_find_f_avx2(int16_t *P,int16_t *T,long n,long len){
+  __m256i first=_mm256_set1_epi16(P[0]);
+  __m256i last=_mm256_set1_epi16(P[len-1]);
+  long j,ret;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(T+j));
+    __m256i b=_mm256_loadu_si256((__m256i *)(T+j+len-1));
+    __m256i hit=_mm256_and_si256(_mm256_cmpeq_epi16(a,first),
+				 _mm256_cmpeq_epi16(b,last));
+    unsigned m=_mm256_movemask_epi8(hit);
+    while(m){
+      long k=j+(__builtin_ctz(m)>>1);
+      if(!memcmp(T+k,P,len*sizeof(*P)))return(k);
+      m&=~(3U<<(__builtin_ctz(m)&~1));
+    }
+  }
+  ret=run_find_f_c(P,T+j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("avx2")))
+static long run_find_r_avx2(int16_t *P,int16_t *T,long n,long len){
+  __m256i first=_mm256_set1_epi16(P[0]);
+  __m256i last=_mm256_set1_epi16(P[1-len]);
+  long j,ret;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(T-j-15));
+    __m256i b=_mm256_loadu_si256((__m256i *)(T-j-15-len+1));
+    __m256i hit=_mm256_and_si256(_mm256_cmpeq_epi16(a,first),
+				 _mm256_cmpeq_epi16(b,last));
+    unsigned m=_mm256_movemask_epi8(hit);
+    while(m){
+      int bit=31-__builtin_clz(m);
+      long k=j+15-(bit>>1);
+      if(!memcmp(T-k-len+1,P-len+1,len*sizeof(*P)))return(k);
+      m&=~(3U<<(bit&~1));
+    }
+  }
+  ret=run_find_r_c(P,T-j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("avx2")))
+static long run_sync_f_avx2(int16_t *A,int16_t *B,long n,long len){
+  long j,ret;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(A+j));
+    __m256i b=_mm256_loadu_si256((__m256i *)(B+j));
+    __m256i c=_mm256_loadu_si256((__m256i *)(A+j+len-1));
+    __m256i d=_mm256_loadu_si256((__m256i *)(B+j+len-1));
+    __m256i hit=_mm256_and_si256(_mm256_cmpeq_epi16(a,b),
+				 _mm256_cmpeq_epi16(c,d));
+    unsigned m=_mm256_movemask_epi8(hit);
+    while(m){
+      long k=j+(__builtin_ctz(m)>>1);
+      if(!memcmp(A+k,B+k,len*sizeof(*A)))return(k);
+      m&=~(3U<<(__builtin_ctz(m)&~1));
+    }
+  }
+  ret=run_sync_f_c(A+j,B+j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+__attribute__((target("avx2")))
+static long run_sync_r_avx2(int16_t *A,int16_t *B,long n,long len){
+  long j,ret;
+  for(j=0;j+16<=n;j+=16){
+    __m256i a=_mm256_loadu_si256((__m256i *)(A-j-15));
+    __m256i b=_mm256_loadu_si256((__m256i *)(B-j-15));
+    __m256i c=_mm256_loadu_si256((__m256i *)(A-j-15-len+1));
+    __m256i d=_mm256_loadu_si256((__m256i *)(B-j-15-len+1));
+    __m256i hit=_mm256_and_si256(_mm256_cmpeq_epi16(a,b),
+				 _mm256_cmpeq_epi16(c,d));
+    unsigned m=_mm256_movemask_epi8(hit);
+    while(m){
+      int bit=31-__builtin_clz(m);
+      long k=j+15-(bit>>1);
+      if(!memcmp(A-k-len+1,B-k-len+1,len*sizeof(*A)))return(k);
+      m&=~(3U<<(bit&~1));
+    }
+  }
+  ret=run_sync_r_c(A-j,B-j,n-j,len);
+  return(ret<0?-1:j+ret);
+}
+
+#endif
+
+/**** Dispatch ***********************************************************/
+
+static long (*run_f)(int16_t *,int16_t *,long);
+static long (*run_r)(int16_t *,int16_t *,long);
+static long (*run_flags_f)(int16_t *,int16_t *,unsigned char *,
+			   unsigned char *,long,int,int);
+static long (*run_flags_r)(int16_t *,int16_t *,unsigned char *,
+			   unsigned char *,long,int,int);
+static long (*run_find_f)(int16_t *,int16_t *,long,long);
+static long (*run_find_r)(int16_t *,int16_t *,long,long);
+static long (*run_sync_f)(int16_t *,int16_t *,long,long);
+static long (*run_sync_r)(int16_t *,int16_t *,long,long);
+
+static pthread_once_t run_once=PTHREAD_ONCE_INIT;
+
+static void i_run_init(void){
+  run_f=run_f_c;
+  run_r=run_r_c;
+  run_flags_f=run_flags_f_c;
+  run_flags_r=run_flags_r_c;
+  run_find_f=run_find_f_c;
+  run_find_r=run_find_r_c;
+  run_sync_f=run_sync_f_c;
+  run_sync_r=run_sync_r_c;
+
+#ifdef RUNS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    run_f=run_f_avx2;
+    run_r=run_r_avx2;
+    run_flags_f=run_flags_f_avx2;
+    run_flags_r=run_flags_r_avx2;
+    run_find_f=run_find_f_avx2;
+    run_find_r=run_find_r_avx2;
+    run_sync_f=run_sync_f_avx2;
+    run_sync_r=run_sync_r_avx2;
+  }else if(__builtin_cpu_supports("sse2")){
+    run_f=run_f_sse2;
+    run_r=run_r_sse2;
+    run_flags_f=run_flags_f_sse2;
+    run_flags_r=run_flags_r_sse2;
+    run_find_f=run_find_f_sse2;
+    run_find_r=run_find_r_sse2;
+    run_sync_f=run_sync_f_sse2;
+    run_sync_r=run_sync_r_sse2;
+  }
+#endif
+}
+
+/* ===========================================================================
+ * i_run_f(), i_run_r(), i_run_flags_f(), i_run_flags_r(),
+ * i_run_find_f(), i_run_find_r(), i_run_sync_f(), i_run_sync_r() (internal)
+ *
+ * See runs.h.  For the backward variants, A, B and the flags point at
+ * the first sample to compare, and the run extends to lower addresses.
+ * The kernels are picked once, by whichever thread gets here first.
+ */
+
+long i_run_f(int16_t *A,int16_t *B,long n){
+  pthread_once(&run_once,i_run_init);
+  return(run_f(A,B,n));
+}
+
+long i_run_r(int16_t *A,int16_t *B,long n){
+  pthread_once(&run_once,i_run_init);
+  return(run_r(A,B,n));
+}
+
+long i_run_flags_f(int16_t *A,int16_t *B,
+		   unsigned char *flagsA,unsigned char *flagsB,
+		   long n,int both,int either){
+  pthread_once(&run_once,i_run_init);
+  return(run_flags_f(A,B,flagsA,flagsB,n,both,either));
+}
+
+long i_run_flags_r(int16_t *A,int16_t *B,
+		   unsigned char *flagsA,unsigned char *flagsB,
+		   long n,int both,int either){
+  pthread_once(&run_once,i_run_init);
+  return(run_flags_r(A,B,flagsA,flagsB,n,both,either));
+}
+
+long i_run_find_f(int16_t *P,int16_t *T,long n,long len){
+  pthread_once(&run_once,i_run_init);
+  return(run_find_f(P,T,n,len));
+}
+
+long i_run_find_r(int16_t *P,int16_t *T,long n,long len){
+  pthread_once(&run_once,i_run_init);
+  return(run_find_r(P,T,n,len));
+}
+
+long i_run_sync_f(int16_t *A,int16_t *B,long n,long len){
+  pthread_once(&run_once,i_run_init);
+  return(run_sync_f(A,B,n,len));
+}
+
+long i_run_sync_r(int16_t *A,int16_t *B,long n,long len){
+  pthread_once(&run_once,i_run_init);
+  return(run_sync_r(A,B,n,len));
+}
+
+#ifdef TEST
+
+/* 'make runs.t': checks every version of the kernels this processor
+ * can run against the plain C versions on random cases (as many as
+ * the first argument says), then times each on a long matching run.
+ * The timings only mean something built with optimization, e.g.
+ * 'make runs.t DEBUG=-O2'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_FLAGS  0x7 /* the kernels don't care what the bits mean */
+#define TEST_SIZE   4096
+#define TEST_CASES  100000
+#define TEST_BENCH  (1L<<20)
+
+typedef struct run_kernels{
+  const char *name;
+  const char *cpu;  /* what __builtin_cpu_supports() must allow */
+  long (*f)(int16_t *,int16_t *,long);
+  long (*r)(int16_t *,int16_t *,long);
+  long (*flags_f)(int16_t *,int16_t *,unsigned char *,
+		  unsigned char *,long,int,int);
+  long (*flags_r)(int16_t *,int16_t *,unsigned char *,
+		  unsigned char *,long,int,int);
+  long (*find_f)(int16_t *,int16_t *,long,long);
+  long (*find_r)(int16_t *,int16_t *,long,long);
+  long (*sync_f)(int16_t *,int16_t *,long,long);
+  long (*sync_r)(int16_t *,int16_t *,long,long);
+} run_kernels;
+
+static run_kernels kernels[]={
+  {"C",NULL,run_f_c,run_r_c,run_flags_f_c,run_flags_r_c,
+   run_find_f_c,run_find_r_c,run_sync_f_c,run_sync_r_c},
+#ifdef RUNS_X86
+  {"SSE2","sse2",run_f_sse2,run_r_sse2,run_flags_f_sse2,run_flags_r_sse2,
+   run_find_f_sse2,run_find_r_sse2,run_sync_f_sse2,run_sync_r_sse2},
+  {"AVX2","avx2",run_f_avx2,run_r_avx2,run_flags_f_avx2,run_flags_r_avx2,
+   run_find_f_avx2,run_find_r_avx2,run_sync_f_avx2,run_sync_r_avx2},
+#endif
+};
+#define KERNELS (long)(sizeof(kernels)/sizeof(*kernels))
+
+static int supported(run_kernels *k){
+  if(!k->cpu)return(1);
+#ifdef RUNS_X86
+  __builtin_cpu_init();
+  if(!strcmp(k->cpu,"sse2"))return(__builtin_cpu_supports("sse2"));
+  if(!strcmp(k->cpu,"avx2"))return(__builtin_cpu_supports("avx2"));
+#endif
+  return(0);
+}
+
+static double now(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return(t.tv_sec+t.tv_nsec*1e-9);
+}
+
+/* One random case: B is A with sparse mismatches, the flags have
+   sparse stop bits, and a narrow range of values makes the find and
+   sync screens pass often at positions that don't match in full. */
+static void fill(int16_t *A,int16_t *B,unsigned char *fA,unsigned char *fB){
+  int range=(rand()&1?5:65536);
+  int miss=(int[]){0,1000,50,4}[rand()&3];
+  int flag=(int[]){0,1000,50}[rand()%3];
+  long j;
+
+  for(j=0;j<TEST_SIZE;j++){
+    A[j]=B[j]=rand()%range-range/2;
+    if(miss && rand()%miss==0)B[j]^=1+(rand()&0xff);
+    fA[j]=(flag && rand()%flag==0 ? rand()&TEST_FLAGS : 0);
+    fB[j]=(flag && rand()%flag==0 ? rand()&TEST_FLAGS : 0);
+  }
+}
+
+#define CHECK(what,got,want)						\
+  if((got)!=(want)){							\
+    fprintf(stderr,"%s %s: %ld, C says %ld (case %ld)\n",		\
+	    k->name,what,(long)(got),(long)(want),c);			\
+    exit(1);								\
+  }
+
+int main(int argc,char **argv){
+  static int16_t A[TEST_SIZE],B[TEST_SIZE];
+  static unsigned char fA[TEST_SIZE],fB[TEST_SIZE];
+  run_kernels *c0=kernels,*k;
+  int16_t *X,*Y;
+  unsigned char *fX;
+  long cases=(argc>1?atol(argv[1]):TEST_CASES);
+  long c,i;
+
+  srand(0);
+  for(c=0;c<cases;c++){
+    /* the start (s) leaves room for (n) plus a run of up to 64 either way */
+    long s=128+rand()%(TEST_SIZE-256);
+    long n=rand()%(min(s,TEST_SIZE-s)-64)+1;
+    long len=(rand()&1?MIN_WORDS_RIFT:rand()%64+1);
+    long shift=rand()%(n+1);
+    int both=rand()&TEST_FLAGS;
+    int either=rand()&TEST_FLAGS;
+
+    fill(A,B,fA,fB);
+    for(i=1;i<KERNELS;i++){
+      k=kernels+i;
+      if(!supported(k))continue;
+      CHECK("run_f",k->f(A+s,B+s,n),c0->f(A+s,B+s,n));
+      CHECK("run_r",k->r(A+s,B+s,n),c0->r(A+s,B+s,n));
+      CHECK("run_flags_f",k->flags_f(A+s,B+s,fA+s,fB+s,n,both,either),
+	    c0->flags_f(A+s,B+s,fA+s,fB+s,n,both,either));
+      CHECK("run_flags_r",k->flags_r(A+s,B+s,fA+s,fB+s,n,both,either),
+	    c0->flags_r(A+s,B+s,fA+s,fB+s,n,both,either));
+      /* a run of A looked for in B, (shift) back from where it is */
+      CHECK("run_find_f",k->find_f(A+s,B+s-shift/2,n/2,len),
+	    c0->find_f(A+s,B+s-shift/2,n/2,len));
+      CHECK("run_find_r",k->find_r(A+s,B+s+shift/2,n/2,len),
+	    c0->find_r(A+s,B+s+shift/2,n/2,len));
+      CHECK("run_sync_f",k->sync_f(A+s,B+s,n-len+1>0?n-len+1:1,len),
+	    c0->sync_f(A+s,B+s,n-len+1>0?n-len+1:1,len));
+      CHECK("run_sync_r",k->sync_r(A+s,B+s,n-len+1>0?n-len+1:1,len),
+	    c0->sync_r(A+s,B+s,n-len+1>0?n-len+1:1,len));
+    }
+  }
+  printf("%ld random cases: ",cases);
+  for(i=1;i<KERNELS;i++)
+    if(supported(kernels+i))printf("%s ",kernels[i].name);
+  printf("agree with C\n");
+
+  /* throughput on one long matching run */
+  X=calloc(TEST_BENCH,sizeof(*X));
+  Y=calloc(TEST_BENCH,sizeof(*Y));
+  fX=calloc(TEST_BENCH,1);
+  for(i=0;i<KERNELS;i++){
+    double t0,t1,t2;
+    int rep;
+    k=kernels+i;
+    if(!supported(k))continue;
+    t0=now();
+    for(rep=0;rep<16;rep++)
+      if(k->f(X,Y,TEST_BENCH)!=TEST_BENCH)exit(1);
+    t1=now();
+    for(rep=0;rep<16;rep++)
+      if(k->flags_f(X,Y,fX,fX,TEST_BENCH,1,2)!=TEST_BENCH)
+	exit(1);
+    t2=now();
+    printf("%-5s run %6.2f Gsamples/s, flags %6.2f Gsamples/s\n",k->name,
+	   16*TEST_BENCH/(t1-t0)*1e-9,16*TEST_BENCH/(t2-t1)*1e-9);
+  }
+  free(X);
+  free(Y);
+  free(fX);
+  return(0);
+}
+
+#endif
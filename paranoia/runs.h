@@ -0,0 +1,38 @@
+/***
+ * CopyPolicy: GNU Lesser General Public License 2.1 applies
+ * Copyright (C) by Monty (xiphmont@mit.edu)
+ ***/
+
+#ifndef _RUNS_H_
+#define _RUNS_H_
+
+/* Forward: the number of samples, up to (n), for which A[j]==B[j]. */
+extern long i_run_f(int16_t *A,int16_t *B,long n);
+
+/* Backward: the number of samples, up to (n), for which A[-j]==B[-j]. */
+extern long i_run_r(int16_t *A,int16_t *B,long n);
+
+/* As above, but also stopping at a sample where the flags have a bit of
+   (both) set on both sides, or a bit of (either) set on either side. */
+extern long i_run_flags_f(int16_t *A,int16_t *B,
+			  unsigned char *flagsA,unsigned char *flagsB,
+			  long n,int both,int either);
+extern long i_run_flags_r(int16_t *A,int16_t *B,
+			  unsigned char *flagsA,unsigned char *flagsB,
+			  long n,int both,int either);
+
+/* Forward: the smallest shift j, below (n), at which T[j+k]==P[k] for
+   all (len) samples k, or -1 if there is none. */
+extern long i_run_find_f(int16_t *P,int16_t *T,long n,long len);
+
+/* Backward: the same, comparing T[-j-k] with P[-k]. */
+extern long i_run_find_r(int16_t *P,int16_t *T,long n,long len);
+
+/* Forward: the smallest j, below (n), at which A[j+k]==B[j+k] for all
+   (len) samples k, or -1 if there is none. */
+extern long i_run_sync_f(int16_t *A,int16_t *B,long n,long len);
+
+/* Backward: the same, comparing A[-j-k] with B[-j-k]. */
+extern long i_run_sync_r(int16_t *A,int16_t *B,long n,long len);
+
+#endif
@@ -4,8 +4,18 @@
 #include <errno.h>
 #include <string.h>
 
-extern long buffering_write(int outf, char *buffer, long num);
-extern int buffering_close(int fd);
+/* buffered output streams; see buffering_write.c */
+typedef struct bw_stream bw_stream;
+
+#define BW_DEFAULT_SIZE  32768 /* bytes */
+#define BW_BACKGROUND    1     /* write full buffers on a thread of their own */
+#define BW_FSYNC         2     /* fsync() when closing */
+#define BW_FSYNC_ALWAYS  4     /* fsync() after every write */
+
+extern bw_stream *bw_open(int fd, long size, int flags);
+extern long bw_write(bw_stream *bw, char *buffer, long num);
+extern int bw_flush(bw_stream *bw);
+extern int bw_close(bw_stream *bw);
 
 /* I wonder how many alignment issues this is gonna trip in the
    future...  it shouldn't trip any...  I guess we'll find out :) */